@@ -0,0 +1,198 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#ifndef BLOCKMODEL_BLOCK_COUNTS_HPP
+#define BLOCKMODEL_BLOCK_COUNTS_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+/// Dense matrix of integer counts between groups of vertices
+/**
+ * This is the storage used by the blockmodels for the number of edges
+ * between pairs of groups and for the number of vertices in the groups.
+ * Unlike \c igraph::Matrix, the elements are stored in row-major order and
+ * every row starts at a cache line boundary, so a row of the matrix is a
+ * contiguous, aligned array that can be passed directly to the inner loops
+ * of the likelihood calculations. The padding at the end of the rows is
+ * always zero.
+ *
+ * A vector of counts is simply represented by a matrix with a single row;
+ * \ref operator[] provides convenient access to its elements.
+ */
+template <typename T>
+class BlockCounts {
+public:
+    /// The alignment of the rows in bytes
+    static const size_t ALIGNMENT = 64;
+
+private:
+    /// The number of elements that fit in \ref ALIGNMENT bytes
+    static const long ELEMENTS_PER_LINE = ALIGNMENT / sizeof(T);
+
+    /// The underlying storage; it is larger than needed to allow alignment
+    std::vector<T> m_storage;
+
+    /// Pointer to the first aligned element of \ref m_storage
+    T* m_data;
+
+    /// The number of rows
+    long m_numRows;
+
+    /// The number of columns
+    long m_numCols;
+
+    /// The distance between the starts of consecutive rows, in elements
+    long m_stride;
+
+public:
+    /// Constructs an empty matrix
+    BlockCounts() : m_storage(), m_data(0), m_numRows(0), m_numCols(0),
+        m_stride(0) {
+        allocate(0, 0);
+    }
+
+    /// Constructs a zero matrix with the given number of rows and columns
+    BlockCounts(long numRows, long numCols) : m_storage(), m_data(0),
+        m_numRows(0), m_numCols(0), m_stride(0) {
+        allocate(numRows, numCols);
+    }
+
+    /// Copy constructor
+    BlockCounts(const BlockCounts<T>& other) : m_storage(), m_data(0),
+        m_numRows(0), m_numCols(0), m_stride(0) {
+        *this = other;
+    }
+
+    /// Assignment operator
+    /**
+     * The copy has its own aligned storage, so the pointer to the first
+     * element cannot simply be copied from the other matrix.
+     */
+    BlockCounts<T>& operator=(const BlockCounts<T>& other) {
+        if (this == &other)
+            return *this;
+        allocate(other.m_numRows, other.m_numCols);
+        if (m_numRows > 0 && m_stride > 0)
+            std::memcpy(m_data, other.m_data, m_numRows * m_stride * sizeof(T));
+        return *this;
+    }
+
+    /// Returns the element in the given row and column
+    T& operator()(long row, long col) {
+        return m_data[row * m_stride + col];
+    }
+
+    /// Returns the element in the given row and column (const variant)
+    const T& operator()(long row, long col) const {
+        return m_data[row * m_stride + col];
+    }
+
+    /// Returns the given element of the first row
+    /**
+     * This is meant to be used with single-row matrices that represent
+     * vectors of counts.
+     */
+    T& operator[](long index) {
+        return m_data[index];
+    }
+
+    /// Returns the given element of the first row (const variant)
+    const T& operator[](long index) const {
+        return m_data[index];
+    }
+
+    /// Adds the given value to the elements (i, j) and (j, i)
+    /**
+     * When i is equal to j, the diagonal element is increased twice, which
+     * is consistent with the convention of the blockmodels where the
+     * diagonal stores twice the number of edges within a group.
+     */
+    void addSymmetric(long i, long j, T delta) {
+        m_data[i * m_stride + j] += delta;
+        m_data[j * m_stride + i] += delta;
+    }
+
+    /// Sets all the elements (except the padding) to the given value
+    void fill(T value) {
+        for (long i = 0; i < m_numRows; i++)
+            std::fill(row(i), row(i) + m_numCols, value);
+    }
+
+    /// Returns the number of columns
+    long numCols() const {
+        return m_numCols;
+    }
+
+    /// Returns the number of rows
+    long numRows() const {
+        return m_numRows;
+    }
+
+    /// Resizes the matrix; all the elements will be set to zero
+    void resize(long numRows, long numCols) {
+        allocate(numRows, numCols);
+    }
+
+    /// Resizes the matrix, keeping the elements that fit in the new size
+    /**
+     * The new elements are set to zero.
+     */
+    void resizeAndKeep(long numRows, long numCols) {
+        BlockCounts<T> old(*this);
+        long rows = std::min(numRows, old.m_numRows);
+        long cols = std::min(numCols, old.m_numCols);
+
+        allocate(numRows, numCols);
+        for (long i = 0; i < rows; i++)
+            std::copy(old.row(i), old.row(i) + cols, row(i));
+    }
+
+    /// Returns a pointer to the first element of the given row
+    /**
+     * The pointer is aligned to \ref ALIGNMENT bytes and it is followed by
+     * \ref stride() elements, the ones beyond \ref numCols() being zero.
+     */
+    T* row(long index) {
+        return m_data + index * m_stride;
+    }
+
+    /// Returns a pointer to the first element of the given row (const variant)
+    const T* row(long index) const {
+        return m_data + index * m_stride;
+    }
+
+    /// Returns the distance between the starts of consecutive rows, in elements
+    long stride() const {
+        return m_stride;
+    }
+
+    /// Returns the sum of the elements in the given row
+    T rowSum(long index) const {
+        T result = 0;
+        const T* ptr = row(index);
+        for (long j = 0; j < m_numCols; j++)
+            result += ptr[j];
+        return result;
+    }
+
+private:
+    /// Allocates zeroed, aligned storage for the given number of rows and columns
+    void allocate(long numRows, long numCols) {
+        m_numRows = numRows;
+        m_numCols = numCols;
+        m_stride = ((numCols + ELEMENTS_PER_LINE - 1) / ELEMENTS_PER_LINE) *
+            ELEMENTS_PER_LINE;
+
+        // Allocate one more cache line than needed so we can always find
+        // an aligned starting position within the storage
+        m_storage.assign(numRows * m_stride + ELEMENTS_PER_LINE, 0);
+
+        size_t misalignment = reinterpret_cast<size_t>(&m_storage[0]) % ALIGNMENT;
+        m_data = &m_storage[0];
+        if (misalignment > 0)
+            m_data += (ALIGNMENT - misalignment) / sizeof(T);
+    }
+};
+
+#endif
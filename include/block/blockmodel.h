@@ -5,13 +5,82 @@
 
 #include <cmath>
 #include <stdexcept>
+#include <vector>
+#include <block/block_counts.hpp>
 #include <igraph/cpp/graph.h>
 #include <igraph/cpp/matrix.h>
 #include <igraph/cpp/vector.h>
 #include <mtwister/mt.h>
 
+#if __cplusplus >= 201103L
+#  include <memory>
+#else
+#  include <tr1/memory>
+#endif
+
 class Blockmodel;
 
+/// Compact, immutable adjacency lists of a graph
+/**
+ * The neighbors of vertex i are stored in \c neighbors between indices
+ * <tt>offsets[i]</tt> (inclusive) and <tt>offsets[i+1]</tt> (exclusive),
+ * so \c offsets has n+1 elements. Loop edges appear twice in the neighbor
+ * list of their vertex and every list is sorted, just like the result of
+ * igraph::Graph::neighbors().
+ *
+ * Instances are never modified after construction, so every copy of a
+ * model fitted to the same graph can share the same instance.
+ */
+class AdjacencyLists {
+public:
+    /// Offsets of the neighbor lists of the vertices in \c neighbors
+    std::vector<int> offsets;
+    /// The concatenated neighbor lists of the vertices
+    std::vector<int> neighbors;
+
+    /// Builds the adjacency lists of the given graph
+    explicit AdjacencyLists(const igraph::Graph& graph);
+};
+
+/// Histogram of the types of the neighbors of a vertex
+/**
+ * This is used as scratch space by the log-likelihood increase calculations
+ * so they do not have to allocate a new vector for every call. \c counts has
+ * (at least) one element for each type and \c types lists the types with
+ * non-zero counts. The histogram must be cleared with \ref clear before
+ * it is used for another vertex.
+ *
+ * Every thread that calculates log-likelihood increases in parallel needs
+ * its own histogram.
+ */
+class NeighborTypeHistogram {
+public:
+    /// The number of neighbors of each type
+    std::vector<double> counts;
+
+    /// The types with non-zero counts in \c counts
+    std::vector<int> types;
+
+    /// Constructor
+    NeighborTypeHistogram() : counts(), types() {}
+
+    /// Resets the counts of the types listed in \c types to zero
+    void clear() {
+        for (std::vector<int>::const_iterator it = types.begin();
+             it != types.end(); it++)
+            counts[*it] = 0;
+        types.clear();
+    }
+
+    /// Makes sure that the histogram can hold the given number of types
+    void reserve(int numTypes) {
+        if (counts.size() < static_cast<size_t>(numTypes)) {
+            counts.resize(numTypes, 0.0);
+            types.reserve(numTypes);
+        }
+    }
+};
+
 /// Simple struct representing a point mutation of a blockmodel
 /**
  * A point mutation is a step that moves vertex i from group k to group l
@@ -45,37 +114,148 @@ private:
     void undo(Blockmodel& model) const;
 };
 
+/// Simple struct representing a move of a set of vertices between groups
+/**
+ * A group mutation moves the given vertices from group \c from to group
+ * \c to. If \c to is equal to the number of groups in the model, a new
+ * group is created for the vertices, so a group mutation can split a group
+ * in two. If group \c from becomes empty, it is removed and the last group
+ * takes over its index, so a group mutation that moves all the vertices of
+ * a group merges two groups.
+ */
+class GroupMutation {
+public:
+    /// The indices of the vertices being moved
+    std::vector<int> vertices;
+	/// The group in which the vertices are before the move
+	int from;
+	/// The group in which the vertices are after the move
+	int to;
+
+	/// Constructor
+	GroupMutation(int from, int to) : vertices(), from(from), to(to) {}
+
+    /// Performs the mutation on the given model
+    /**
+     * The vertices are moved one by one with point mutations, so the
+     * log-likelihood of the model is updated incrementally.
+     */
+    void perform(Blockmodel& model) const;
+};
+
 /// Abstract base class for various types of blockmodels
 class Blockmodel {
 protected:
     /// Pointer to a graph to which this model will be fitted
     igraph::Graph* m_pGraph;
 
+    /// Compact copy of the adjacency lists of \ref m_pGraph
+    /**
+     * This is built once in \ref setGraph so the hot paths of the model
+     * and the optimization strategies do not have to query the graph
+     * (which would allocate a new vector for every call). The lists are
+     * immutable, so copies of the model share them instead of copying
+     * O(n+m) elements in every \ref assignFrom or \ref clone call.
+     */
+#if __cplusplus >= 201103L
+    std::shared_ptr<const AdjacencyLists> m_pAdjacency;
+#else
+    std::tr1::shared_ptr<const AdjacencyLists> m_pAdjacency;
+#endif
+
+    /// Offsets of the neighbor lists of the vertices in \ref m_neighbors
+    /**
+     * Points into \ref m_pAdjacency (or it is null if the model is not
+     * associated to a graph); it is cached here to spare an indirection
+     * in the hot paths.
+     */
+    const int* m_neighborOffsets;
+
+    /// Concatenated neighbor lists of the vertices
+    /**
+     * Points into \ref m_pAdjacency; it is null if the model is not
+     * associated to a graph or the graph has no edges.
+     */
+    const int* m_neighbors;
+
     /// The number of types in the model
     int m_numTypes;
 
     /// Vector storing the vertex types
-    igraph::Vector m_types;
+    std::vector<int> m_types;
 
     /// Vector storing the number of vertices of a given type
-    igraph::Vector m_typeCounts;
+    /**
+     * This is a count matrix with a single row. Vertex indices are stored
+     * as \c int everywhere, so the counts always fit in an \c int.
+     */
+    BlockCounts<int> m_typeCounts;
 
     /// Matrix storing the number of edges between pairs of vertex types
     /**
      * Due to some optimizations, the diagonal of the matrix actually stores
      * twice the number of edges going between vertices of the same type.
+     * The matrix is symmetric, so row i can also be used as column i.
+     * The counts are stored as \c long like the sums of degrees, since
+     * the diagonal may exceed the range of an \c int on large graphs.
+     */
+    BlockCounts<long> m_edgeCounts;
+
+    /// Sum of degrees for vertices in a given group
+    /**
+     * This equals the row sums of \ref m_edgeCounts, but it is maintained
+     * incrementally so it can be queried in constant time.
      */
-    igraph::Matrix m_edgeCounts;
+    std::vector<long> m_sumOfDegreesByType;
     
     /// Cached value of the log-likelihood
     mutable double m_logLikelihood;
 
+    /// Scratch histogram for counting the neighbors of a vertex by type
+    /**
+     * This is used by the non-const log-likelihood increase calculations
+     * and by \ref setType. Every method that uses it must clear it before
+     * returning.
+     */
+    NeighborTypeHistogram m_histogram;
+
+    /// Whether the per-vertex neighbor type histograms are maintained
+    bool m_neighborTypeCacheEnabled;
+
+    /// Types in the cached neighbor type histograms of the vertices
+    /**
+     * The histogram of vertex i occupies the same index range as the
+     * neighbor list of vertex i in \ref m_neighbors, since a vertex cannot
+     * have more distinct neighbor types than neighbors. Only the first
+     * <tt>m_numCachedNeighborTypes[i]</tt> entries of the range are used.
+     * The vector is empty if the cache is disabled.
+     */
+    std::vector<int> m_cachedNeighborTypes;
+
+    /// Counts in the cached neighbor type histograms of the vertices
+    /**
+     * Element j of this vector is the number of neighbors having type
+     * <tt>m_cachedNeighborTypes[j]</tt>.
+     */
+    std::vector<int> m_cachedNeighborTypeCounts;
+
+    /// The number of distinct neighbor types of each vertex in the cache
+    std::vector<int> m_numCachedNeighborTypes;
+
 public:
     /// Constructs a new blockmodel not associated with any given graph
     explicit Blockmodel()
-        : m_pGraph(0), m_numTypes(0), m_types(),
-		  m_typeCounts(), m_edgeCounts(), m_logLikelihood(1) {
+        : m_pGraph(0), m_pAdjacency(), m_neighborOffsets(0), m_neighbors(0),
+          m_numTypes(0), m_types(),
+		  m_typeCounts(), m_edgeCounts(), m_sumOfDegreesByType(),
+          m_logLikelihood(1),
+          m_histogram(),
+          m_neighborTypeCacheEnabled(false), m_cachedNeighborTypes(),
+          m_cachedNeighborTypeCounts(), m_numCachedNeighborTypes() {
     }
+
+    /// Destructor
+    virtual ~Blockmodel() {}
 	
 	/// Copies a blockmodel to another one
 	/**
@@ -98,6 +278,13 @@ public:
 		assignFrom(other.get());
 	}
 
+	/// Creates a new copy of the blockmodel with the same dynamic type
+	/**
+	 * The copy is associated to the same graph as the original model.
+	 * The caller is responsible for deleting the returned object.
+	 */
+	virtual Blockmodel* clone() const = 0;
+
     /// Convenience function to create a blockmodel instance
     /**
      * This function could not have been made a constructor as it calls virtual
@@ -120,11 +307,55 @@ public:
     /// Generates a new graph according to the current parameters of the blockmodel
     virtual igraph::Graph generate(MersenneTwister& rng) const = 0;
 
+    /// Returns the neighbor counts of the cached neighbor type histogram of a vertex
+    /**
+     * Element j of the result is the number of neighbors of the vertex
+     * whose type is element j of \ref getCachedNeighborTypes. The cache
+     * must be enabled with \ref setNeighborTypeCacheEnabled.
+     */
+    const int* getCachedNeighborTypeCounts(long index) const {
+        return m_cachedNeighborTypeCounts.empty() ? 0 :
+            &m_cachedNeighborTypeCounts[0] + m_neighborOffsets[index];
+    }
+
+    /// Returns the types in the cached neighbor type histogram of a vertex
+    /**
+     * The result points to \ref getNumCachedNeighborTypes elements, listing
+     * the distinct types among the neighbors of the vertex in no particular
+     * order. The cache must be enabled with \ref setNeighborTypeCacheEnabled.
+     */
+    const int* getCachedNeighborTypes(long index) const {
+        return m_cachedNeighborTypes.empty() ? 0 :
+            &m_cachedNeighborTypes[0] + m_neighborOffsets[index];
+    }
+
+    /// Counts the neighbors of the given vertex by type into the given histogram
+    /**
+     * The histogram must be empty. The caller must clear it when the
+     * counts are not needed any more. The counts are copied from the
+     * neighbor type cache if it is enabled.
+     */
+    void countNeighborTypes(long index, NeighborTypeHistogram& histogram) const;
+
+    /// Returns the degree of the given vertex in the associated graph
+    int getDegree(long index) const {
+        return m_neighborOffsets[index+1] - m_neighborOffsets[index];
+    }
+
     /// Returns the number of edges between the two given groups
     long getEdgeCount(long ri, long ci) const {
         return m_edgeCounts(ri, ci);
     }
 
+    /// Returns the sum of the degrees of the vertices in the given group
+    /**
+     * This is the sum of a row of the edge count matrix; it is maintained
+     * incrementally, so it takes constant time.
+     */
+    long getSumOfDegrees(int type) const {
+        return m_sumOfDegreesByType[type];
+    }
+
 	/**
 	 * Returns the actual number of edges after a point mutation
 	 * between the two affected groups and others.
@@ -141,9 +372,7 @@ public:
 			igraph::Vector& countsFrom, igraph::Vector& countsTo) const;
 
     /// Returns the whole edge count matrix
-    igraph::Matrix getEdgeCounts() const {
-        return m_edgeCounts;
-    }
+    igraph::Matrix getEdgeCounts() const;
 
 	/// Returns the probability of the given edge in the model
 	virtual double getEdgeProbability(int v1, int v2) = 0;
@@ -153,6 +382,20 @@ public:
         return m_pGraph;
     }
 
+    /// Returns a pointer to the first neighbor of the given vertex
+    /**
+     * Together with \ref getNeighborsEnd, this can be used to iterate over
+     * the neighbors of a vertex without allocating a new vector.
+     */
+    const int* getNeighborsBegin(long index) const {
+        return m_neighbors + m_neighborOffsets[index];
+    }
+
+    /// Returns a pointer to one past the last neighbor of the given vertex
+    const int* getNeighborsEnd(long index) const {
+        return m_neighbors + m_neighborOffsets[index+1];
+    }
+
     /// Returns the log-likelihood of the model
     double getLogLikelihood() const {
         if (m_logLikelihood < 0)
@@ -160,6 +403,16 @@ public:
         return recalculateLogLikelihood();
     }
 
+    /// Returns the contribution of the given pair of groups to the log-likelihood
+    /**
+     * The log-likelihood of the model is the sum of these terms over the
+     * unordered pairs of groups (including the pairs of a group with
+     * itself) plus a term that depends on the graph only. The terms are
+     * never positive; the term of a group with itself is low if the group
+     * is large and poorly described as a homogeneous block.
+     */
+    virtual double getLogLikelihoodTerm(int type1, int type2) const = 0;
+
     /// Returns the increase in the log-likelihood of the model after a point mutation
     /**
      * The default is a dumb implementation which actually performs the move and
@@ -168,11 +421,56 @@ public:
      */
     virtual double getLogLikelihoodIncrease(const PointMutation& mutation);
 
+    /// Returns the increase in the log-likelihood of the model for all possible moves of a vertex
+    /**
+     * Element j of the result will contain the increase in the log-likelihood
+     * after moving the given vertex to group j; the element corresponding to
+     * the current group of the vertex will be zero. The result vector is
+     * resized to the number of types if needed.
+     *
+     * This variant uses the scratch histogram of the model; see the const
+     * variant for calculations running in parallel.
+     */
+    void getLogLikelihoodIncreases(long index, igraph::Vector& result) {
+        getLogLikelihoodIncreases(index, result, m_histogram);
+    }
+
+    /// Returns the increase in the log-likelihood of the model for all possible moves of a vertex
+    /**
+     * This variant does not modify the model, so it can be called from
+     * multiple threads at the same time as long as every thread uses its
+     * own result vector and histogram.
+     *
+     * \param  index      the index of the vertex being moved
+     * \param  result     the increases for all the groups are stored here
+     * \param  histogram  scratch space for the calculation; it is cleared
+     *                    again before returning
+     */
+    virtual void getLogLikelihoodIncreases(long index, igraph::Vector& result,
+            NeighborTypeHistogram& histogram) const = 0;
+
+    /// Returns the increase in the log-likelihood after merging two groups
+    /**
+     * The increase is calculated from the edge and type counts only, in
+     * O(k) steps where k is the number of groups; see \ref mergeTypes.
+     * The result is usually negative as the merged group is described
+     * less accurately than the original two.
+     */
+    virtual double getMergeLogLikelihoodIncrease(int type1, int type2) const = 0;
+
     /// Returns the number of observations in this model
     long getNumObservations() const {
         return (m_pGraph->vcount() * (m_pGraph->vcount()-1) / 2);
     }
 
+    /// Returns the number of distinct types among the neighbors of a vertex
+    /**
+     * The cache must be enabled with \ref setNeighborTypeCacheEnabled.
+     */
+    int getNumCachedNeighborTypes(long index) const {
+        return m_numCachedNeighborTypes[index];
+    }
+
     /// Returns the number of free parameters in this model
     virtual int getNumParameters() const = 0;
 
@@ -213,20 +511,29 @@ public:
     }
 
     /// Returns the whole type count vector
-    igraph::Vector getTypeCounts() const {
-        return m_typeCounts;
-    }
+    igraph::Vector getTypeCounts() const;
 
     /// Returns the whole type vector
-    igraph::Vector getTypes() const {
-        return m_types;
-    }
+    igraph::Vector getTypes() const;
     
     /// Returns the number of vertices in the model
     size_t getVertexCount() const {
         return m_types.size();
     }
 
+    /// Returns whether the per-vertex neighbor type histograms are maintained
+    bool isNeighborTypeCacheEnabled() const {
+        return m_neighborTypeCacheEnabled;
+    }
+
+    /// Merges two groups of the model into one
+    /**
+     * The merged group gets the smaller of the two indices and the last
+     * group takes over the larger one, so the group indices stay
+     * contiguous. The number of types is decreased by one.
+     */
+    void mergeTypes(int type1, int type2);
+
     /// Performs the given mutation on the model
     virtual void performMutation(const PointMutation& mutation) {
 		mutation.perform(*this);
@@ -235,20 +542,47 @@ public:
 	/// Randomizes the current configuration of the model
 	virtual void randomize(MersenneTwister& rng);
 
+    /// Removes an empty group from the model
+    /**
+     * The last group takes over the index of the removed group and the
+     * number of types is decreased by one.
+     */
+    void removeEmptyType(int type);
+
     /// Returns the log-likelihood of the model (with forced recalculation)
     virtual double recalculateLogLikelihood() const = 0;
 
+    /// Enables or disables the per-vertex neighbor type histograms
+    /**
+     * When the cache is enabled, the model keeps a sparse histogram of the
+     * types of the neighbors for every vertex, which is updated by
+     * \ref setType whenever a vertex changes its type. The log-likelihood
+     * increase calculations and the optimization strategies can then read
+     * the histogram of a vertex in time proportional to the number of
+     * distinct neighbor types instead of scanning all its neighbors, at the
+     * expense of a slower \ref setType and O(m) extra memory.
+     *
+     * The cache is disabled by default.
+     */
+    void setNeighborTypeCacheEnabled(bool enabled);
+
     /// Sets the graph associated to the model
     /**
      * If the graph is not NULL, the type vector will be resized to the number
      * of vertices in the graph and the edge counts will be re-calculated.
+     *
+     * The adjacency lists of the graph are cached in the model, so this
+     * method must be called again if the graph is modified afterwards.
      */
     virtual void setGraph(igraph::Graph* graph);
 
     /// Sets the number of types
     /**
-     * This method should be called only after construction as it will
-     * re-create the edge count matrix and the type count vector
+     * If the model already has some types and all the removed types are
+     * empty, the counts of the remaining types are kept and the new types
+     * are empty, so groups can be added or removed in O(k^2) steps.
+     * Otherwise, the edge count matrix and the type count vector are
+     * re-created and the edges are recounted.
      */
     virtual void setNumTypes(int numTypes);
 
@@ -259,7 +593,19 @@ public:
     void setTypes(const igraph::Vector& types);
 
 protected:
-    /// Recounts the edges and updates m_typeCounts and m_edgeCounts
+    /// Rebuilds the neighbor type histograms of all the vertices
+    /**
+     * This is a no-op if the neighbor type cache is disabled.
+     */
+    void rebuildNeighborTypeCache();
+
+    /// Rebuilds the cached neighbor lists from the associated graph
+    void rebuildNeighborLists();
+
+    /// Updates the neighbor type histogram of a vertex after a neighbor moved
+    void updateNeighborTypeCache(long index, int oldType, int newType);
+
+    /// Recounts the edges and updates m_typeCounts, m_edgeCounts and m_sumOfDegreesByType
     virtual void recountEdges();
 
     /// Invalidates the cached log-likelihood value
@@ -278,14 +624,36 @@ private:
      */
     igraph::Matrix m_probabilities;
 
+    /// Contributions of the pairs of vertex types to the log-likelihood
+    /**
+     * Element (i, j) stores the log-likelihood term of the vertex pairs
+     * between groups i and j; the matrix is symmetric. The terms are filled
+     * by \ref recalculateLogLikelihood and only the rows of the affected
+     * groups are updated after a point mutation, so the log-likelihood can
+     * be kept up-to-date in O(k) steps instead of O(k^2).
+     */
+    mutable igraph::Matrix m_logLikelihoodTerms;
+
+    /// Whether \ref m_logLikelihoodTerms is in sync with the edge counts
+    mutable bool m_logLikelihoodTermsValid;
+
+    /// Drift counter for the iterative re-calculation of log-likelihood
+    mutable int m_driftCounter;
+
 public:
     /// Constructs a new undirected blockmodel not associated with any given graph
-    explicit UndirectedBlockmodel() : Blockmodel() {}
+    explicit UndirectedBlockmodel() : Blockmodel(), m_probabilities(),
+        m_logLikelihoodTerms(), m_logLikelihoodTermsValid(false),
+        m_driftCounter(0) {}
 
 	virtual void assignFrom(const Blockmodel* other) {
 		*this = dynamic_cast<const UndirectedBlockmodel&>(*other);
 	}
 
+	virtual UndirectedBlockmodel* clone() const {
+		return new UndirectedBlockmodel(*this);
+	}
+
     /// Generates a new graph according to the current parameters of the blockmodel
     virtual igraph::Graph generate(MersenneTwister& rng) const;
 
@@ -297,6 +665,18 @@ public:
     /// Returns the increase in the log-likelihood of the model after a point mutation
     virtual double getLogLikelihoodIncrease(const PointMutation& mutation);
 
+    using Blockmodel::getLogLikelihoodIncreases;
+
+    /// Returns the increase in the log-likelihood of the model for all possible moves of a vertex
+    virtual void getLogLikelihoodIncreases(long index, igraph::Vector& result,
+            NeighborTypeHistogram& histogram) const;
+
+    /// Returns the contribution of the given pair of groups to the log-likelihood
+    virtual double getLogLikelihoodTerm(int type1, int type2) const;
+
+    /// Returns the increase in the log-likelihood after merging two groups
+    virtual double getMergeLogLikelihoodIncrease(int type1, int type2) const;
+
     /// Returns the number of free parameters in this model
 	virtual int getNumParameters() const {
         return (m_numTypes * (m_numTypes+1) / 2.) + m_types.size() + 1;
@@ -342,6 +722,27 @@ public:
      * (i.e. m_pGraph is NULL).
      */
     void setProbabilities(const igraph::Matrix& p);
+
+    /// Sets the type of a single vertex
+    /**
+     * This method is overridden from the parent because the log-likelihood
+     * can be updated incrementally by re-calculating the terms of the
+     * affected groups only.
+     *
+     * However, after every 8192 steps, we re-calculate the sum of the terms
+     * completely to avoid the accumulation of numerical errors.
+     */
+    virtual void setType(long index, int newType);
+
+protected:
+    /// Recounts the edges and updates m_typeCounts and m_edgeCounts
+    virtual void recountEdges();
+
+    /// Updates the log-likelihood terms of the given two types
+    /**
+     * \return  the change in the log-likelihood
+     */
+    double updateLogLikelihoodTerms(int type1, int type2);
 };
 
 /// Class representing an undirected degree-corrected blockmodel
@@ -352,7 +753,14 @@ private:
 	 * This vector stores the actual degrees of the vertices in the graph if
 	 * the model is associated to a graph.
 	 */
-    igraph::Vector m_degrees;
+    std::vector<int> m_degrees;
+
+    /// Matrix storing the Poisson rates between pairs of vertex types
+    /**
+     * This is used only if there is no graph associated to the model (i.e.
+     * m_pGraph is NULL); otherwise the rates are given by the edge counts.
+     */
+    igraph::Matrix m_rates;
 
 	/// Drift counter for the iterative re-calculation of log-likelihood
 	double m_driftCounter;
@@ -365,37 +773,38 @@ private:
 	 */
 	igraph::Vector m_stickinesses;
 
-    /// Sum of degrees for vertices in a given group
-    igraph::Vector m_sumOfDegreesByType;
-
 public:
     /**
      * \brief Constructs a new undirected degree-corrected blockmodel not
      *        associated with any given graph
      */
     explicit DegreeCorrectedUndirectedBlockmodel()
-        : Blockmodel(), m_degrees(), m_driftCounter(0), m_stickinesses(),
-		m_sumOfDegreesByType() {}
+        : Blockmodel(), m_degrees(), m_rates(), m_driftCounter(0),
+        m_stickinesses() {}
 
 	virtual void assignFrom(const Blockmodel* other) {
 		*this = dynamic_cast<const DegreeCorrectedUndirectedBlockmodel&>(*other);
 	}
 
+	virtual DegreeCorrectedUndirectedBlockmodel* clone() const {
+		return new DegreeCorrectedUndirectedBlockmodel(*this);
+	}
+
     /// Generates a new graph according to the current parameters of the blockmodel
     virtual igraph::Graph generate(MersenneTwister& rng) const;
 
 	/// Returns the probability of the given edge in the model
 	virtual double getEdgeProbability(int v1, int v2) {
 		int type1 = m_types[v1], type2 = m_types[v2];
-		double lambda = m_edgeCounts(type1, type2);
+		double lambda = getRate(type1, type2);
 
 		if (m_pGraph == NULL) {
 			/* No graph associated */
 			lambda *= m_stickinesses[v1] * m_stickinesses[v2];
 		} else {
 			/* We have a graph, so we use m_degrees */
-			lambda *= m_degrees[v1] / m_sumOfDegreesByType[type1];
-			lambda *= m_degrees[v2] / m_sumOfDegreesByType[type2];
+			lambda *= static_cast<double>(m_degrees[v1]) / m_sumOfDegreesByType[type1];
+			lambda *= static_cast<double>(m_degrees[v2]) / m_sumOfDegreesByType[type2];
 		}
 
 		return 1 - std::exp(-lambda);
@@ -404,6 +813,23 @@ public:
     /// Returns the increase in the log-likelihood of the model after a point mutation
     virtual double getLogLikelihoodIncrease(const PointMutation& mutation);
 
+    using Blockmodel::getLogLikelihoodIncreases;
+
+    /// Returns the increase in the log-likelihood of the model for all possible moves of a vertex
+    virtual void getLogLikelihoodIncreases(long index, igraph::Vector& result,
+            NeighborTypeHistogram& histogram) const;
+
+    /// Returns the contribution of the given pair of groups to the log-likelihood
+    /**
+     * The term of groups r and s is \f$e_{rs} \log(e_{rs} / (D_r D_s))\f$
+     * where \f$D_r\f$ is the sum of degrees in group r; it is halved for
+     * r = s as the diagonal of the edge count matrix is doubled.
+     */
+    virtual double getLogLikelihoodTerm(int type1, int type2) const;
+
+    /// Returns the increase in the log-likelihood after merging two groups
+    virtual double getMergeLogLikelihoodIncrease(int type1, int type2) const;
+
     /// Returns the number of free parameters in this model
 	virtual int getNumParameters() const {
         return (m_numTypes * (m_numTypes+1) / 2.) + 2 * m_types.size() + 1;
@@ -431,10 +857,11 @@ public:
 	 * instead of re-calculating it completely.
 	 *
 	 * However, after every 8192 steps, we re-calculate the log-likelihood
-	 * completely to avoid the accumulation of numerical errors.
+	 * completely to avoid the accumulation of numerical errors. The same
+	 * happens if the cached log-likelihood was not valid before the move.
 	 */
     virtual void performMutation(const PointMutation& mutation) {
-		if (m_driftCounter < 8192) {
+		if (m_logLikelihood < 0 && m_driftCounter < 8192) {
 			double oldLogLikelihood = m_logLikelihood;
 			double increase = getLogLikelihoodIncrease(mutation);
 			Blockmodel::performMutation(mutation);
@@ -449,9 +876,6 @@ public:
     /// Returns the log-likelihood of the model (with forced recalculation)
     virtual double recalculateLogLikelihood() const;
 
-    /// Recounts the edges and updates m_typeCounts, m_edgeCounts and m_sumOfDegreesByType
-    virtual void recountEdges();
-
     /// Sets the graph associated to the model
     /**
      * If the graph is not NULL, the type vector will be resized to the number
@@ -480,8 +904,5 @@ public:
      * (i.e. m_pGraph is NULL).
      */
     void setRates(const igraph::Matrix& r);
-
-    /// Sets the type of a single vertex
-    virtual void setType(long index, int newType);
 };
 #endif
@@ -3,6 +3,8 @@
 #ifndef BLOCKMODEL_CONVERGENCE_H
 #define BLOCKMODEL_CONVERGENCE_H
 
+#include <string>
+#include <vector>
 #include <block/statistics.h>
 #include <igraph/cpp/vector.h>
 
@@ -84,5 +86,63 @@ public:
     virtual void reset();
 };
 
+/// Convergence criterion for multiple chains based on the Gelman-Rubin diagnostic
+/**
+ * This class expects the samples passed to \ref check to be the
+ * concatenation of equally long blocks of log-likelihood values from
+ * several independent Markov chains. The blocks are accumulated between
+ * the calls, and the first half of them is discarded as burn-in. The
+ * class compares the variance of the retained log-likelihoods within the
+ * chains with the variance of the means of the chains and calculates the
+ * potential scale reduction factor:
+ *
+ * \f[ \hat{R} = \sqrt{\frac{(n-1)/n W + (m+1)/m B/n}{W}} \f]
+ *
+ * where \f$m\f$ is the number of chains, \f$n\f$ is the number of
+ * retained samples per chain, \f$W\f$ is the mean of the variances within
+ * the chains and \f$B/n\f$ is the variance of the means of the chains.
+ * The chains are said to have converged if \f$\hat{R}\f$ is less than a
+ * given threshold (1.1 by default).
+ */
+class GelmanRubinConvergenceCriterion : public ConvergenceCriterion {
+private:
+    /// The number of chains whose samples are passed to \ref check
+    int m_numChains;
+
+    /// The number of samples per chain in the blocks passed so far
+    std::vector<long> m_blockLengths;
+
+    /// The means of the blocks passed so far
+    /**
+     * Element <tt>i * m_numChains + j</tt> belongs to block i of chain j.
+     */
+    std::vector<double> m_blockMeans;
+
+    /// The sums of squared deviations from the mean in the blocks passed so far
+    /**
+     * The elements are indexed the same way as in \ref m_blockMeans.
+     */
+    std::vector<double> m_blockSquares;
+
+    /// The potential scale reduction factor after the last block
+    double m_rHat;
+
+    /// The threshold for the potential scale reduction factor
+    float m_threshold;
+
+public:
+    explicit GelmanRubinConvergenceCriterion(int numChains,
+            float threshold = 1.1);
+
+    virtual bool check(const igraph::Vector& samples);
+    virtual std::string report() const;
+    virtual void reset();
+
+    /// Returns the potential scale reduction factor after the last block
+    double getRHat() const {
+        return m_rHat;
+    }
+};
+
 #endif
 
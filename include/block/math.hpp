@@ -3,6 +3,7 @@
 #ifndef BLOCKMODEL_MATH_H
 #define BLOCKMODEL_MATH_H
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <numeric>
@@ -17,6 +18,100 @@ inline bool block_isnan(T x) {
 #define isnan(x) block_isnan(x)
 #endif
 
+/// Lookup table for the values of x*log(x) for non-negative integers
+/**
+ * Almost every term in the log-likelihood functions of the models is of the
+ * form x*log(x) where x is an integer count (the number of edges between
+ * two groups, the number of vertex pairs between two groups or the sum of
+ * the degrees in a group). This class stores these values in a contiguous
+ * table that is shared between all the models, so the likelihood
+ * calculations can avoid most calls to std::log and always get the very
+ * same value for the same count.
+ *
+ * The table is filled with \ref DEFAULT_SIZE entries during static
+ * initialization, before \c main() is entered. A program that knows the
+ * size of its graph should call \ref reserve once, from a single thread and
+ * before any parallel region, so that the group sizes, the edge counts and
+ * the sums of degrees of the graph are all covered; the table is never
+ * modified afterwards, so it can be read from any number of threads
+ * without synchronization. Arguments beyond the size of the table fall back
+ * to calculating x*log(x) directly.
+ *
+ * The number of vertex pairs between two groups is usually far too large
+ * for the table, so the likelihood functions assemble x*log(x) of these
+ * products from the entries of the two group sizes instead (see
+ * \ref xlogx_product). The number of vertex pairs \em without an edge
+ * cannot be factored like that, so on graphs with large groups it still
+ * takes one direct calculation for every pair of groups with at least one
+ * edge between them.
+ */
+class XLogXTable {
+public:
+    /// The number of entries filled during static initialization
+    static const long DEFAULT_SIZE = 1L << 18;
+
+    /// The maximum number of entries in the table
+    static const long MAX_SIZE = 1L << 24;
+
+    /// Returns x*log(x) for the given non-negative integer x
+    /**
+     * Zero is returned for zero (and for negative arguments).
+     */
+    static double get(long x) {
+        if (x >= 0 && x < m_size)
+            return m_values[x];
+        return (x > 0) ? x * std::log(static_cast<double>(x)) : 0.0;
+    }
+
+    /// Makes sure that the table contains at least the given number of entries
+    /**
+     * The size of the table never exceeds \ref MAX_SIZE. This must not be
+     * called while another thread may read the table.
+     */
+    static void reserve(long size);
+
+    /// Returns the number of entries in the table
+    static long size() {
+        return m_size;
+    }
+
+private:
+    /// Fills the table with the given number of entries
+    static void fill(long size);
+
+    /// Fills the default entries of the table during static initialization
+    static long initialize();
+
+    /// Pointer to the first element of the table
+    static const double* m_values;
+
+    /// The number of entries in the table
+    /**
+     * This is zero until the table is filled, so the lookups made by other
+     * static initializers fall back to direct calculation.
+     */
+    static long m_size;
+};
+
+/// Shorthand for \ref XLogXTable::get
+inline double xlogx(long x) {
+    return XLogXTable::get(x);
+}
+
+/// Returns x*log(x) for the product of two non-negative integers a and b
+/**
+ * The product is looked up directly if it fits in the table. Otherwise,
+ * since \f$ab \log(ab) = b (a \log a) + a (b \log b)\f$, the result is
+ * assembled from the table entries of the factors, which are much more
+ * likely to be in the table than the product.
+ */
+inline double xlogx_product(long a, long b) {
+    long ab = a * b;
+    if (ab < XLogXTable::size())
+        return xlogx(ab);
+    return b * xlogx(a) + a * xlogx(b);
+}
+
 /// Calculates the moving average of some time series
 template <typename T>
 class MovingAverage {
@@ -41,6 +136,13 @@ public:
     MovingAverage(int size) : m_data(size), m_windowSize(size),
         m_next(m_data.begin()), m_end(m_data.end()), m_sum() {}
 
+    /// Removes all the entries; the average becomes zero
+    void clear() {
+        std::fill(m_data.begin(), m_data.end(), T());
+        m_next = m_data.begin();
+        m_sum = 0;
+    }
+
     /// Adds a new entry to the internal storage
     void push_back(T value) {
         m_sum += (value - *m_next);
@@ -59,5 +161,103 @@ public:
     }
 };
 
-#endif
+/// Fenwick tree (binary indexed tree) of non-negative weights
+/**
+ * The tree stores a vector of weights and supports changing a weight,
+ * calculating prefix sums and finding the element at a given cumulative
+ * weight in O(log n) steps. It is used to sample elements proportionally
+ * to weights that change one by one.
+ *
+ * Changing the weights many times accumulates rounding errors in the
+ * partial sums, so the tree should be rebuilt from time to time with
+ * \ref assign.
+ */
+template <typename T>
+class FenwickTree {
+private:
+    /// The weights of the elements
+    std::vector<T> m_values;
+
+    /// The partial sums; element i is the sum of the weights in (i - lowbit(i), i]
+    std::vector<T> m_tree;
+
+    /// The largest power of two not greater than the number of elements
+    long m_topBit;
 
+public:
+    /// Constructs an empty tree
+    FenwickTree() : m_values(), m_tree(1), m_topBit(0) {}
+
+    /// Replaces the weights of the tree in O(n) steps
+    void assign(const std::vector<T>& values) {
+        long n = values.size();
+
+        m_values = values;
+        m_tree.assign(n + 1, T());
+        for (long i = 1; i <= n; i++) {
+            m_tree[i] += values[i-1];
+            long parent = i + (i & -i);
+            if (parent <= n)
+                m_tree[parent] += m_tree[i];
+        }
+
+        for (m_topBit = 1; m_topBit <= n; m_topBit <<= 1);
+        m_topBit >>= 1;
+    }
+
+    /// Finds the element at the given cumulative weight
+    /**
+     * \return  the smallest index i such that the sum of the first i+1
+     *          weights is larger than \c value. Indices whose weight is
+     *          zero are never returned unless \c value is not less than
+     *          the total weight due to rounding, in which case the last
+     *          element is returned.
+     */
+    long find(T value) const {
+        long pos = 0, n = m_values.size();
+
+        for (long step = m_topBit; step > 0; step >>= 1) {
+            if (pos + step <= n && m_tree[pos + step] <= value) {
+                pos += step;
+                value -= m_tree[pos];
+            }
+        }
+
+        return pos < n ? pos : n - 1;
+    }
+
+    /// Returns the weight of the given element
+    T get(long index) const {
+        return m_values[index];
+    }
+
+    /// Returns the sum of the first \c count weights
+    T prefixSum(long count) const {
+        T result = T();
+        for (; count > 0; count -= (count & -count))
+            result += m_tree[count];
+        return result;
+    }
+
+    /// Sets the weight of the given element
+    void set(long index, T value) {
+        T delta = value - m_values[index];
+        long n = m_values.size();
+
+        m_values[index] = value;
+        for (long i = index + 1; i <= n; i += (i & -i))
+            m_tree[i] += delta;
+    }
+
+    /// Returns the number of elements
+    long size() const {
+        return m_values.size();
+    }
+
+    /// Returns the sum of all the weights
+    T total() const {
+        return prefixSum(m_values.size());
+    }
+};
+
+#endif
@@ -0,0 +1,48 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#ifndef BLOCKMODEL_MERGING_H
+#define BLOCKMODEL_MERGING_H
+
+#include <block/blockmodel.h>
+
+/// Agglomerative merging of the groups of a blockmodel
+/**
+ * The merger repeatedly merges the pair of groups whose merge decreases
+ * the log-likelihood the least. The cost of merging a pair is calculated
+ * by \ref Blockmodel::getMergeLogLikelihoodIncrease in O(k) steps from the
+ * edge and type counts of the model.
+ *
+ * A merge changes the cost of every pair, not only of the pairs involving
+ * the merged groups: the cost of merging groups a and b depends on the
+ * edges between a, b and every other group, including the merged one.
+ * The model may also be modified between the merges (e.g. polished by a
+ * few Markov chain steps). Cached costs would therefore go out of date
+ * in ways that cannot be bounded, so the costs of all the pairs are
+ * re-calculated from the current state of the model before every merge,
+ * which takes O(k^3) steps.
+ */
+class GroupMerger {
+private:
+    /// The number of groups of the model after the last merge
+    int m_numTypes;
+
+public:
+    /// Constructs a merger that is not associated to any model yet
+    GroupMerger();
+
+    /// Associates the merger to a model
+    void initialize(const Blockmodel* pModel);
+
+    /// Merges the pair of groups of the model whose merge is the cheapest
+    /**
+     * The model must be the same as the one passed to \ref initialize (or
+     * to the previous call), but it may have been modified in the
+     * meantime as long as the number of its groups did not change. Ties
+     * are broken in favour of the pair with the smallest indices.
+     *
+     * \return  the increase in the log-likelihood caused by the merge
+     */
+    double mergeCheapestPair(Blockmodel* pModel);
+};
+
+#endif
@@ -7,8 +7,13 @@
 #include <cmath>
 #include <limits>
 #include <memory>
+#include <numeric>
+#include <queue>
+#include <utility>
+#include <vector>
 #include <block/blockmodel.h>
 #include <block/math.hpp>
+#include <block/parallel.hpp>
 #include <igraph/cpp/types.h>
 #include <mtwister/mt.h>
 
@@ -23,6 +28,9 @@ public:
     /// Constructs an optimization strategy not attached to any model
     OptimizationStrategy() : m_stepCount(0) {}
 
+    /// Destructor
+    virtual ~OptimizationStrategy() {}
+
     /// Returns the number of steps taken so far
     int getStepCount() const {
         return m_stepCount;
@@ -48,6 +56,11 @@ public:
  * This strategy takes a blockmodel and repeatedly moves vertices between
  * groups in a way that maximizes the local contribution of a vertex to
  * the global likelihood.
+ *
+ * All the vertices are evaluated against the same (old) configuration and
+ * the new types are applied at once at the end of the step, so the
+ * evaluation is distributed among multiple threads if OpenMP is available.
+ * The result does not depend on the number of threads.
  */
 template <typename Model>
 class GreedyStrategy : public OptimizationStrategy<Model> {
@@ -55,17 +68,27 @@ public:
     virtual bool step(Model* pModel) {
         long int n = pModel->getGraph()->vcount();
         int k = pModel->getNumTypes();
+        const Model* pConstModel = pModel;
         igraph::Vector newTypes(pModel->getTypes());
 
+        // Thread-local scratch space is allocated up front
+        int numThreads = getMaxThreadCount();
+        std::vector<igraph::Vector> increases(numThreads, igraph::Vector(k));
+        std::vector<NeighborTypeHistogram> histograms(numThreads);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 256)
+#endif
         for (long int i = 0; i < n; i++) {
+            int thread = getThreadIndex();
+            igraph::Vector& threadIncreases = increases[thread];
             double bestLogL = 0;
-            double newLogL;
 
+            pConstModel->getLogLikelihoodIncreases(i, threadIncreases,
+                    histograms[thread]);
             for (int j = 0; j < k; j++) {
-                PointMutation mutation(i, newTypes[i], j);
-                newLogL = pModel->getLogLikelihoodIncrease(mutation);
-                if (newLogL > bestLogL) {
-                    bestLogL = newLogL;
+                if (threadIncreases[j] > bestLogL) {
+                    bestLogL = threadIncreases[j];
                     newTypes[i] = j;
                 }
             }
@@ -77,6 +100,407 @@ public:
     }
 };
 
+/// Greedy optimization strategy that only revisits vertices near the last changes
+/**
+ * After the first few sweeps of \ref GreedyStrategy, only a small fraction
+ * of the vertices change their types, but \ref GreedyStrategy still
+ * evaluates all of them in every step. This strategy keeps a worklist of
+ * "dirty" vertices instead: the vertices that were moved in the last step
+ * and their neighbors. Only these vertices are evaluated in the next step.
+ *
+ * The moves also change the group sizes, which affects the scores of other
+ * vertices slightly. Therefore, when the worklist becomes empty, a full
+ * sweep is performed over all the vertices, and the optimization stops only
+ * if this sweep does not find any improving moves.
+ *
+ * In asynchronous (Gauss-Seidel) mode, the moves are applied immediately,
+ * so every vertex is evaluated against the current configuration and
+ * every move increases the log-likelihood. In synchronous (Jacobi) mode,
+ * all the vertices in the worklist are evaluated against the same
+ * configuration (in parallel if OpenMP is available) and the moves are
+ * applied at once at the end of the step; the moves are undone if they do
+ * not increase the log-likelihood together.
+ *
+ * The worklist is kept between the steps, so \ref reset must be called if
+ * the strategy is used with another model or the model is modified
+ * outside the strategy.
+ */
+template <typename Model>
+class WorklistGreedyStrategy : public OptimizationStrategy<Model> {
+private:
+    /// Whether the moves are applied immediately
+    bool m_asynchronous;
+
+    /// The vertices to be evaluated in the next step
+    std::vector<long> m_worklist;
+
+    /// Whether a given vertex is in \ref m_worklist
+    std::vector<char> m_inWorklist;
+
+    /// Minimum log-likelihood increase that is considered an improvement
+    /**
+     * This prevents the strategy from moving vertices back and forth due
+     * to rounding errors.
+     */
+    double m_tolerance;
+
+public:
+    /// Constructor
+    explicit WorklistGreedyStrategy(bool asynchronous = true)
+        : OptimizationStrategy<Model>(), m_asynchronous(asynchronous),
+        m_worklist(), m_inWorklist(), m_tolerance(1e-9) {}
+
+    /// Returns whether the moves are applied immediately
+    bool isAsynchronous() const {
+        return m_asynchronous;
+    }
+
+    /// Clears the worklist; the next step will be a full sweep
+    void reset() {
+        m_worklist.clear();
+        m_inWorklist.clear();
+    }
+
+    /// Sets whether the moves are applied immediately
+    void setAsynchronous(bool asynchronous) {
+        m_asynchronous = asynchronous;
+    }
+
+    virtual bool step(Model* pModel) {
+        long int n = pModel->getGraph()->vcount();
+
+        if (m_inWorklist.size() != static_cast<size_t>(n))
+            reset();
+
+        while (true) {
+            bool fullSweep = m_worklist.empty();
+            std::vector<long> current;
+
+            if (fullSweep) {
+                current.resize(n);
+                for (long int i = 0; i < n; i++)
+                    current[i] = i;
+                m_inWorklist.assign(n, 0);
+            } else {
+                current.swap(m_worklist);
+                for (size_t i = 0; i < current.size(); i++)
+                    m_inWorklist[current[i]] = 0;
+            }
+
+            bool changed = m_asynchronous ?
+                asynchronousPass(pModel, current) :
+                synchronousPass(pModel, current);
+
+            if (changed || fullSweep) {
+                this->stepDone();
+                return changed;
+            }
+        }
+    }
+
+private:
+    /// Adds the given vertex and its neighbors to the worklist
+    void markDirty(const Model* pModel, long int vertex) {
+        if (!m_inWorklist[vertex]) {
+            m_inWorklist[vertex] = 1;
+            m_worklist.push_back(vertex);
+        }
+
+        const int* end = pModel->getNeighborsEnd(vertex);
+        for (const int* it = pModel->getNeighborsBegin(vertex); it != end; it++) {
+            if (!m_inWorklist[*it]) {
+                m_inWorklist[*it] = 1;
+                m_worklist.push_back(*it);
+            }
+        }
+    }
+
+    /// Evaluates and moves the given vertices one by one
+    bool asynchronousPass(Model* pModel, const std::vector<long>& vertices) {
+        igraph::Vector increases(pModel->getNumTypes());
+        NeighborTypeHistogram histogram;
+        bool changed = false;
+
+        for (size_t i = 0; i < vertices.size(); i++) {
+            long int vertex = vertices[i];
+            int bestType = bestMove(pModel, vertex, increases, histogram);
+            if (bestType >= 0) {
+                pModel->setType(vertex, bestType);
+                markDirty(pModel, vertex);
+                changed = true;
+            }
+        }
+
+        return changed;
+    }
+
+    /// Returns the best destination group of a vertex or -1 if it should stay
+    int bestMove(const Model* pModel, long int vertex, igraph::Vector& increases,
+            NeighborTypeHistogram& histogram) const {
+        int k = pModel->getNumTypes(), result = -1;
+        double bestLogL = m_tolerance;
+
+        pModel->getLogLikelihoodIncreases(vertex, increases, histogram);
+        for (int j = 0; j < k; j++) {
+            if (increases[j] > bestLogL) {
+                bestLogL = increases[j];
+                result = j;
+            }
+        }
+
+        return result;
+    }
+
+    /// Evaluates the given vertices against the same configuration and moves them at once
+    bool synchronousPass(Model* pModel, const std::vector<long>& vertices) {
+        long int numVertices = vertices.size();
+        int k = pModel->getNumTypes();
+        std::vector<int> newTypes(numVertices);
+
+        // Thread-local scratch space is allocated up front
+        int numThreads = getMaxThreadCount();
+        std::vector<igraph::Vector> increases(numThreads, igraph::Vector(k));
+        std::vector<NeighborTypeHistogram> histograms(numThreads);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 256)
+#endif
+        for (long int i = 0; i < numVertices; i++) {
+            int thread = getThreadIndex();
+            newTypes[i] = bestMove(pModel, vertices[i], increases[thread],
+                    histograms[thread]);
+        }
+
+        // Apply the moves and remember the old types
+        double oldLogL = pModel->getLogLikelihood();
+        std::vector<int> oldTypes(numVertices);
+        bool changed = false;
+        for (long int i = 0; i < numVertices; i++) {
+            oldTypes[i] = pModel->getType(vertices[i]);
+            if (newTypes[i] >= 0) {
+                pModel->setType(vertices[i], newTypes[i]);
+                changed = true;
+            }
+        }
+
+        if (!changed)
+            return false;
+
+        // The moves were evaluated independently; undo them if they do not
+        // improve the log-likelihood together
+        if (pModel->getLogLikelihood() <= oldLogL) {
+            for (long int i = numVertices-1; i >= 0; i--)
+                pModel->setType(vertices[i], oldTypes[i]);
+            return false;
+        }
+
+        for (long int i = 0; i < numVertices; i++) {
+            if (newTypes[i] >= 0)
+                markDirty(pModel, vertices[i]);
+        }
+
+        return true;
+    }
+};
+
+/// Kernighan-Lin / Fiduccia-Mattheyses style refinement strategy
+/**
+ * In each step (pass), this strategy repeatedly takes the unlocked vertex
+ * whose best single move increases the log-likelihood the most (or
+ * decreases it the least), moves it to the best group and locks it for the
+ * rest of the pass. Since moves with negative gains are allowed as well,
+ * a pass can climb out of shallow local optima that stop
+ * \ref GreedyStrategy. At the end of the pass, the moves after the best
+ * prefix of the pass are rolled back, so a pass never decreases the
+ * log-likelihood.
+ *
+ * The best moves of the vertices are kept in a priority queue. After
+ * a move, only the gains of the neighbors of the moved vertex are
+ * re-calculated; the gain of a vertex popped from the queue is checked
+ * again before it is moved, since the move of a non-neighbor vertex
+ * changes the group sizes as well. Outdated entries of the queue are
+ * skipped lazily.
+ *
+ * A pass is also stopped after a given number of consecutive moves that
+ * did not improve on the best prefix.
+ */
+template <typename Model>
+class KernighanLinStrategy : public OptimizationStrategy<Model> {
+private:
+    /// An entry in the gain queue
+    struct GainEntry {
+        double gain;
+        long vertex;
+        long version;
+
+        GainEntry(double gain, long vertex, long version)
+            : gain(gain), vertex(vertex), version(version) {}
+
+        bool operator<(const GainEntry& other) const {
+            if (gain != other.gain)
+                return gain < other.gain;
+            // Prefer vertices with smaller indices for ties
+            return vertex > other.vertex;
+        }
+    };
+
+    /// Maximum number of consecutive moves not improving on the best prefix
+    long m_maxNonImprovingMoves;
+
+    /// Minimum log-likelihood increase that is considered an improvement
+    double m_tolerance;
+
+    /// Scratch vector for the log-likelihood increases
+    igraph::Vector m_increases;
+
+    /// Scratch histogram for the log-likelihood increases
+    NeighborTypeHistogram m_histogram;
+
+public:
+    /// Constructor
+    explicit KernighanLinStrategy(long maxNonImprovingMoves = 1000)
+        : OptimizationStrategy<Model>(),
+        m_maxNonImprovingMoves(maxNonImprovingMoves), m_tolerance(1e-9),
+        m_increases(), m_histogram() {}
+
+    /// Returns the maximum number of consecutive non-improving moves in a pass
+    long getMaxNonImprovingMoves() const {
+        return m_maxNonImprovingMoves;
+    }
+
+    /// Sets the maximum number of consecutive non-improving moves in a pass
+    void setMaxNonImprovingMoves(long value) {
+        m_maxNonImprovingMoves = value;
+    }
+
+    /// Runs one refinement pass
+    /**
+     * Returns true if the pass increased the log-likelihood.
+     */
+    virtual bool step(Model* pModel) {
+        long int n = pModel->getGraph()->vcount();
+        std::priority_queue<GainEntry> queue;
+        std::vector<long> versions(n, 0);
+        std::vector<int> bestTypes(n);
+        std::vector<char> locked(n, 0);
+        std::vector<std::pair<long, int> > moves;
+        double gain = 0.0, totalGain = 0.0, bestTotalGain = 0.0;
+        size_t bestPrefixLength = 0;
+
+        // Fill the queue with the best moves of all the vertices
+        for (long int i = 0; i < n; i++) {
+            bestTypes[i] = bestMove(pModel, i, &gain);
+            if (bestTypes[i] >= 0)
+                queue.push(GainEntry(gain, i, 0));
+        }
+
+        while (!queue.empty()) {
+            GainEntry entry = queue.top();
+            queue.pop();
+
+            long int vertex = entry.vertex;
+            if (locked[vertex] || entry.version != versions[vertex])
+                continue;
+
+            // The gain may have changed since the entry was added due to
+            // the changes in the group sizes; if it decreased, put the
+            // vertex back with the correct gain
+            bestTypes[vertex] = bestMove(pModel, vertex, &gain);
+            if (bestTypes[vertex] < 0)
+                continue;
+            if (gain < entry.gain - m_tolerance) {
+                queue.push(GainEntry(gain, vertex, ++versions[vertex]));
+                continue;
+            }
+
+            // Move the vertex and lock it
+            moves.push_back(std::make_pair(vertex, pModel->getType(vertex)));
+            pModel->setType(vertex, bestTypes[vertex]);
+            locked[vertex] = 1;
+
+            totalGain += gain;
+            if (totalGain > bestTotalGain + m_tolerance) {
+                bestTotalGain = totalGain;
+                bestPrefixLength = moves.size();
+            } else if (static_cast<long>(moves.size() - bestPrefixLength) >=
+                    m_maxNonImprovingMoves) {
+                break;
+            }
+
+            // Update the gains of the unlocked neighbors
+            const int* end = pModel->getNeighborsEnd(vertex);
+            for (const int* it = pModel->getNeighborsBegin(vertex); it != end; it++) {
+                if (locked[*it])
+                    continue;
+                bestTypes[*it] = bestMove(pModel, *it, &gain);
+                versions[*it]++;
+                if (bestTypes[*it] >= 0)
+                    queue.push(GainEntry(gain, *it, versions[*it]));
+            }
+        }
+
+        // Roll back to the best prefix
+        while (moves.size() > bestPrefixLength) {
+            pModel->setType(moves.back().first, moves.back().second);
+            moves.pop_back();
+        }
+
+        this->stepDone();
+
+        return bestPrefixLength > 0;
+    }
+
+private:
+    /// Returns the best destination group of a vertex other than its own
+    /**
+     * The log-likelihood increase of the move is stored in \c gain. Returns
+     * -1 if the model has only one group.
+     */
+    int bestMove(const Model* pModel, long int vertex, double* gain) {
+        int k = pModel->getNumTypes(), type = pModel->getType(vertex);
+        int result = -1;
+
+        pModel->getLogLikelihoodIncreases(vertex, m_increases, m_histogram);
+        for (int j = 0; j < k; j++) {
+            if (j != type && (result < 0 || m_increases[j] > *gain)) {
+                *gain = m_increases[j];
+                result = j;
+            }
+        }
+
+        return result;
+    }
+};
+
+/// Returns the group whose term with itself is the lowest in the log-likelihood
+/**
+ * This is the group that is described the worst by a single homogeneous
+ * block, so it is a good candidate for splitting. Only groups with at least
+ * two vertices are considered.
+ *
+ * \return  the index of the group or -1 if all the groups have less than
+ *          two vertices
+ */
+int findWorstGroup(const Blockmodel* pModel);
+
+/// Splits a group of a blockmodel in two by a greedy bisection
+/**
+ * Half of the vertices of the group are moved to the new group by a
+ * breadth-first search from a random vertex within the group, then the
+ * vertices of the two groups are moved greedily between them as long as
+ * this increases the log-likelihood, up to the given number of sweeps.
+ * The vertices of other groups are not touched.
+ *
+ * \param  pModel     the model whose group is split
+ * \param  type       the group being split
+ * \param  newType    the group that receives half of the vertices; it
+ *                    should be empty
+ * \param  rng        random number generator for the initial split
+ * \param  maxSweeps  the maximum number of greedy sweeps
+ */
+void bisectGroup(Blockmodel* pModel, int type, int newType,
+        MersenneTwister& rng, int maxSweeps = 10);
+
 /// Optimization strategy that uses a random number generator
 template <typename Model>
 class RandomizedOptimizationStrategy : public OptimizationStrategy<Model> {
@@ -97,8 +521,91 @@ public:
     void setRNG(MersenneTwister* pRng) {
         m_pRng.reset(pRng);
     }
+
+protected:
+    /// Fills the given buffer with uniform random numbers from [0, 1)
+    /**
+     * The buffer is grown if needed but never shrunk, so it can be reused
+     * between the blocks of a sweep without reallocation. The numbers are
+     * the same as the ones returned by \c count calls to \c random().
+     */
+    void fillRandomNumbers(std::vector<double>& buffer, size_t count) {
+        if (buffer.size() < count)
+            buffer.resize(count);
+        for (size_t i = 0; i < count; i++)
+            buffer[i] = m_pRng->random();
+    }
+};
+
+/// The order in which a sweep of a Markov chain visits the vertices
+/**
+ * The vertices are divided into blocks of consecutive indices. The blocks
+ * are visited in a random order that is shuffled before every sweep, and
+ * the vertices within a block are visited in increasing order of their
+ * indices, so consecutive updates touch nearby parts of the neighbor lists
+ * and the random numbers of a block can be drawn at once. Every update of
+ * the chain leaves the stationary distribution invariant, so the sweeps
+ * sample the same distribution as the randomly selected vertices.
+ */
+class SweepOrder {
+private:
+    /// The number of vertices in a block
+    long m_blockSize;
+
+    /// The number of vertices the blocks were created for
+    long m_numVertices;
+
+    /// The first vertices of the blocks in the order of the current sweep
+    std::vector<long> m_blockStarts;
+
+public:
+    /// Constructor
+    explicit SweepOrder(long blockSize = 256) : m_blockSize(blockSize),
+        m_numVertices(0), m_blockStarts() {}
+
+    /// Returns the first vertex of the block visited at the given position
+    long getBlockStart(long index) const {
+        return m_blockStarts[index];
+    }
+
+    /// Returns one past the last vertex of the block visited at the given position
+    long getBlockEnd(long index) const {
+        return std::min(m_blockStarts[index] + m_blockSize, m_numVertices);
+    }
+
+    /// Returns the number of vertices in a block
+    long getBlockSize() const {
+        return m_blockSize;
+    }
+
+    /// Returns the number of blocks
+    long getNumBlocks() const {
+        return m_blockStarts.size();
+    }
+
+    /// Shuffles the order of the blocks for a new sweep over the given number of vertices
+    void shuffle(long numVertices, MersenneTwister& rng) {
+        if (numVertices != m_numVertices) {
+            m_numVertices = numVertices;
+            m_blockStarts.clear();
+            for (long i = 0; i < numVertices; i += m_blockSize)
+                m_blockStarts.push_back(i);
+        }
+
+        for (long i = static_cast<long>(m_blockStarts.size()) - 1; i > 0; i--)
+            std::swap(m_blockStarts[i], m_blockStarts[rng.randint(i+1)]);
+    }
 };
 
+/// Proposal distributions of \ref MetropolisHastingsStrategy
+typedef enum {
+    /// The new group of the vertex is chosen uniformly
+    UNIFORM_PROPOSAL,
+
+    /// The new group is chosen based on the groups of the neighbors
+    NEIGHBOR_PROPOSAL
+} ProposalDistribution;
+
 /// Metropolis-Hastings algorithm for a blockmodel
 /**
  * In each step, a vertex is selected randomly and a random new group is
@@ -111,6 +618,27 @@ public:
  *    this case, the new group is accepted with a probability equal to
  *    the likelihood ratio of the new and the old configuration. If the
  *    new group is rejected, the same sample will be returned.
+
+ *
+ * By default, the new group is chosen uniformly, so most of the proposals
+ * are rejected when the number of groups is large. With the neighbor
+ * proposal, a random neighbor of the vertex is selected instead, and if
+ * it is in group t, the new group s is chosen with probability
+ *
+ * \f[ \frac{e_{ts} + \epsilon}{e_t + \epsilon k} \f]
+ *
+ * where \f$e_{ts}\f$ is the number of edges between groups t and s and
+ * \f$e_t\f$ is the sum of the degrees in group t (Peixoto, 2014). The
+ * proposals thus follow the block structure of the model, while the
+ * \f$\epsilon\f$ term keeps every group reachable. This proposal is not
+ * symmetric, so the ratio of the reverse and the forward proposal
+ * probabilities enters the acceptance decision. Isolated vertices are
+ * moved with the uniform proposal.
+ *
+ * The strategy may also sample from a flattened version of the likelihood
+ * distribution by setting an inverse temperature \f$\beta < 1\f$; in this
+ * case, the log-likelihood differences are multiplied by \f$\beta\f$
+ * before the acceptance decision. This is used by parallel tempering.
  */
 class MetropolisHastingsStrategy : public RandomizedOptimizationStrategy<Blockmodel> {
 private:
@@ -120,10 +648,34 @@ private:
     /// Whether the last proposal was accepted or not
     bool m_lastProposalAccepted;
 
+    /// The inverse temperature of the chain
+    double m_inverseTemperature;
+
+    /// The proposal distribution of the new groups
+    ProposalDistribution m_proposalDistribution;
+
+    /// The weight of the uniform part of the neighbor proposal
+    double m_epsilon;
+
+    /// Scratch histogram for the neighbor types of the selected vertex
+    NeighborTypeHistogram m_histogram;
+
+    /// The order of the vertices in the sweeps
+    SweepOrder m_sweepOrder;
+
+    /// The random numbers of the current block of a sweep
+    std::vector<double> m_randomNumbers;
+
+    /// Whether moves that would empty a group are rejected
+    bool m_keepGroupsNonEmpty;
+
 public:
     /// Constructor
     MetropolisHastingsStrategy() : RandomizedOptimizationStrategy<Blockmodel>(),
-        m_acceptanceRatio(1000), m_lastProposalAccepted(false) {
+        m_acceptanceRatio(1000), m_lastProposalAccepted(false),
+        m_inverseTemperature(1.0), m_proposalDistribution(UNIFORM_PROPOSAL),
+        m_epsilon(1.0), m_histogram(), m_sweepOrder(), m_randomNumbers(),
+        m_keepGroupsNonEmpty(false) {
     }
 
     /// Returns the acceptance ratio
@@ -131,77 +683,810 @@ public:
         return m_acceptanceRatio.value();
     }
 
+    /// Returns the weight of the uniform part of the neighbor proposal
+    double getEpsilon() const {
+        return m_epsilon;
+    }
+
+    /// Returns the inverse temperature of the chain
+    double getInverseTemperature() const {
+        return m_inverseTemperature;
+    }
+
+    /// Returns the proposal distribution of the new groups
+    ProposalDistribution getProposalDistribution() const {
+        return m_proposalDistribution;
+    }
+
+    /// Returns whether moves that would empty a group are rejected
+    bool getKeepGroupsNonEmpty() const {
+        return m_keepGroupsNonEmpty;
+    }
+
+    /// Sets the weight of the uniform part of the neighbor proposal
+    /**
+     * The weight must be positive, otherwise some moves could not be
+     * reversed.
+     */
+    void setEpsilon(double epsilon) {
+        m_epsilon = epsilon;
+    }
+
+    /// Sets the inverse temperature of the chain
+    void setInverseTemperature(double beta) {
+        m_inverseTemperature = beta;
+    }
+
+    /// Sets the proposal distribution of the new groups
+    void setProposalDistribution(ProposalDistribution proposalDistribution) {
+        m_proposalDistribution = proposalDistribution;
+    }
+
+    /// Sets whether moves that would empty a group are rejected
+    /**
+     * The chain then stays on the models whose groups are all non-empty,
+     * which is needed when it is interleaved with \ref MergeSplitStrategy:
+     * a group emptied by a point move could only disappear by a move that
+     * has no reverse. Rejecting the moves keeps the detailed balance with
+     * respect to the distribution restricted to these models.
+     */
+    void setKeepGroupsNonEmpty(bool keepGroupsNonEmpty) {
+        m_keepGroupsNonEmpty = keepGroupsNonEmpty;
+    }
+
     /// Advances the Markov chain by one step
     virtual bool step(Blockmodel* pModel) {
         int i = m_pRng->randint(pModel->getGraph()->vcount());
-        int newType = m_pRng->randint(pModel->getNumTypes());
+        double logHastingsRatio = 0.0;
+        int newType;
+
+        if (m_proposalDistribution == NEIGHBOR_PROPOSAL && pModel->getDegree(i) > 0) {
+            double u1 = m_pRng->random();
+            double u2 = m_pRng->random();
+            newType = proposeNeighborType(pModel, i, u1, u2, logHastingsRatio);
+        } else {
+            newType = m_pRng->randint(pModel->getNumTypes());
+        }
+
         PointMutation mutation(i, pModel->getType(i), newType);
-        double logLDiff = pModel->getLogLikelihoodIncrease(mutation);
+        if (emptiesGroup(pModel, mutation)) {
+            finishStep(pModel, mutation, false);
+            return true;
+        }
 
-        m_lastProposalAccepted =
-            (logLDiff >= 0) || (m_pRng->random() <= std::exp(logLDiff));
-        if (m_lastProposalAccepted)
+        double logLDiff = logHastingsRatio +
+            m_inverseTemperature * pModel->getLogLikelihoodIncrease(mutation);
+
+        finishStep(pModel, mutation,
+                (logLDiff >= 0) || (m_pRng->random() <= std::exp(logLDiff)));
+
+        return true;
+    }
+
+    /// Advances the Markov chain by a sweep over all the vertices
+    /**
+     * Every vertex gets one update in the order given by \ref SweepOrder,
+     * and the random numbers needed by a block of vertices are drawn in a
+     * single batch before the block. The step counter and the acceptance
+     * ratio are updated after every vertex as if \ref step was called.
+     */
+    void sweep(Blockmodel* pModel) {
+        long numBlocks = startSweep(pModel);
+        for (long b = 0; b < numBlocks; b++)
+            sweepBlock(pModel, b);
+    }
+
+    /// Starts a new sweep over all the vertices
+    /**
+     * The blocks of the sweep must be updated by \ref sweepBlock in
+     * increasing order of their positions; this allows the caller to
+     * observe the chain between the blocks.
+     *
+     * \return  the number of blocks in the sweep
+     */
+    long startSweep(Blockmodel* pModel) {
+        m_sweepOrder.shuffle(pModel->getGraph()->vcount(), *m_pRng);
+        return m_sweepOrder.getNumBlocks();
+    }
+
+    /// Updates the vertices of the block at the given position of the current sweep
+    void sweepBlock(Blockmodel* pModel, long index) {
+        long start = m_sweepOrder.getBlockStart(index);
+        long end = m_sweepOrder.getBlockEnd(index);
+
+        fillRandomNumbers(m_randomNumbers, 3 * (end - start));
+        const double* u = &m_randomNumbers[0];
+        for (long i = start; i < end; i++, u += 3)
+            updateVertex(pModel, i, u);
+    }
+
+    /// Returns whether the last proposal was accepted or not
+    bool wasLastProposalAccepted() const {
+        return m_lastProposalAccepted;
+    }
+
+private:
+    /// Returns whether the mutation must be rejected because it empties a group
+    bool emptiesGroup(const Blockmodel* pModel, const PointMutation& mutation) const {
+        return m_keepGroupsNonEmpty && mutation.from != mutation.to &&
+            pModel->getTypeCount(mutation.from) == 1;
+    }
+
+    /// Performs the mutation if it was accepted and updates the statistics
+    void finishStep(Blockmodel* pModel, const PointMutation& mutation,
+            bool accepted) {
+        m_lastProposalAccepted = accepted;
+        if (accepted)
             pModel->performMutation(mutation);
 
-        m_acceptanceRatio.push_back(m_lastProposalAccepted);
+        m_acceptanceRatio.push_back(accepted);
 
         stepDone();
+    }
 
-        return true;
+    /// Proposes a new group for the given vertex and accepts or rejects it
+    /**
+     * \param  pModel  the model
+     * \param  vertex  the vertex being updated
+     * \param  u       three uniform random numbers; the first two are used
+     *                 by the proposal, the third one by the acceptance
+     */
+    void updateVertex(Blockmodel* pModel, long vertex, const double* u) {
+        double logHastingsRatio = 0.0;
+        int newType;
+
+        if (m_proposalDistribution == NEIGHBOR_PROPOSAL && pModel->getDegree(vertex) > 0)
+            newType = proposeNeighborType(pModel, vertex, u[0], u[1], logHastingsRatio);
+        else
+            newType = static_cast<int>(u[0] * pModel->getNumTypes());
+
+        PointMutation mutation(vertex, pModel->getType(vertex), newType);
+        if (emptiesGroup(pModel, mutation)) {
+            finishStep(pModel, mutation, false);
+            return;
+        }
+
+        double logLDiff = logHastingsRatio +
+            m_inverseTemperature * pModel->getLogLikelihoodIncrease(mutation);
+
+        finishStep(pModel, mutation, (logLDiff >= 0) || (u[2] <= std::exp(logLDiff)));
+    }
+
+    /// Returns the probability that the neighbor proposal moves a vertex to a group
+    /**
+     * The neighbor types of the vertex must be counted in \ref m_histogram.
+     * If \c pMutation is not null, the probability is calculated as if the
+     * given mutation of the same vertex had been performed already. The
+     * neighbor types of the vertex do not change by moving the vertex, and
+     * the edge count between groups a and b changes by
+     * \f$([a = s] - [a = r]) c_b + ([b = s] - [b = r]) c_a\f$ when the
+     * vertex moves from group r to group s, where \f$c_a\f$ is the number
+     * of its neighbors in group a.
+     */
+    double getNeighborProposalProbability(const Blockmodel* pModel, long vertex,
+            int type, const PointMutation* pMutation) const {
+        const std::vector<double>& counts = m_histogram.counts;
+        int k = pModel->getNumTypes();
+        int degree = pModel->getDegree(vertex);
+        double result = 0.0;
+
+        for (std::vector<int>::const_iterator it = m_histogram.types.begin();
+             it != m_histogram.types.end(); it++) {
+            int t = *it;
+            double edges = pModel->getEdgeCount(t, type);
+            double degreeSum = pModel->getSumOfDegrees(t);
+
+            if (pMutation != 0) {
+                int r = pMutation->from, s = pMutation->to;
+                edges += ((t == s) - (t == r)) * counts[type] +
+                    ((type == s) - (type == r)) * counts[t];
+                degreeSum += ((t == s) - (t == r)) * degree;
+            }
+
+            result += counts[t] * (edges + m_epsilon) / (degreeSum + m_epsilon * k);
+        }
+
+        return result / degree;
+    }
+
+    /// Draws a new group for a vertex from the neighbor proposal
+    /**
+     * \param  pModel            the model
+     * \param  vertex            the vertex being moved; it must not be isolated
+     * \param  u1                uniform random number to select the neighbor
+     * \param  u2                uniform random number to select the group
+     * \param  logHastingsRatio  the logarithm of the ratio of the reverse and
+     *                           the forward proposal probabilities is
+     *                           returned here
+     * \return  the proposed new group of the vertex
+     */
+    int proposeNeighborType(const Blockmodel* pModel, long vertex,
+            double u1, double u2, double& logHastingsRatio) {
+        const int* neighbors = pModel->getNeighborsBegin(vertex);
+        int k = pModel->getNumTypes();
+        int t = pModel->getType(neighbors[static_cast<int>(u1 * pModel->getDegree(vertex))]);
+        double degreeSum = pModel->getSumOfDegrees(t);
+        double u = u2 * (degreeSum + m_epsilon * k);
+        int oldType = pModel->getType(vertex), newType;
+
+        // Either a uniform group, or a group chosen proportionally to the
+        // edge counts in the row of group t
+        if (u >= degreeSum) {
+            newType = std::min(static_cast<int>((u - degreeSum) / m_epsilon), k-1);
+        } else {
+            newType = 0;
+            u -= pModel->getEdgeCount(t, 0);
+            while (u >= 0 && newType < k-1) {
+                newType++;
+                u -= pModel->getEdgeCount(t, newType);
+            }
+        }
+
+        logHastingsRatio = 0.0;
+        if (newType != oldType) {
+            PointMutation mutation(vertex, oldType, newType);
+            pModel->countNeighborTypes(vertex, m_histogram);
+            logHastingsRatio =
+                std::log(getNeighborProposalProbability(pModel, vertex, oldType, &mutation)) -
+                std::log(getNeighborProposalProbability(pModel, vertex, newType, 0));
+            m_histogram.clear();
+        }
+
+        return newType;
+    }
+};
+
+/// Merge-split sampler that changes the number of groups of a blockmodel
+/**
+ * In each step, two distinct vertices i and j are selected randomly. If
+ * they are in the same group, the group is proposed to be split in two
+ * such that j stays in the group and i moves to a new group; otherwise,
+ * the groups of i and j are proposed to be merged. Splits are generated by
+ * restricted Gibbs sampling (Jain and Neal, 2004): the other vertices of the
+ * group are assigned randomly to the two halves, then they are reassigned
+ * a few times according to their conditional distribution restricted to
+ * the two halves. The probability of the last reassignment sweep enters
+ * the Hastings ratio; for merges, the same procedure is used to calculate
+ * the probability of the reverse split without changing the model.
+ *
+ * The log-likelihood always increases with the number of groups, so the
+ * chain samples from the distribution proportional to
+ *
+ * \f[ \exp(L - \lambda k (k+1) / 2) \f]
+ *
+ * where L is the log-likelihood, k is the number of groups and
+ * \f$\lambda\f$ is the penalty of a block parameter. As the other
+ * parameters of the models do not depend on k, \f$\lambda = 1\f$ gives the
+ * distribution proportional to exp(-AIC/2) and \f$\lambda = \log(N)/2\f$
+ * gives exp(-BIC/2), where N is the number of observations.
+ *
+ * Point moves do not change the number of groups, so the strategy can be
+ * interleaved with \ref MetropolisHastingsStrategy to sample over the
+ * number of groups with a single chain. The point moves must not empty a
+ * group then (see \ref MetropolisHastingsStrategy::setKeepGroupsNonEmpty),
+ * and the model must not have empty groups to begin with.
+ */
+class MergeSplitStrategy : public RandomizedOptimizationStrategy<Blockmodel> {
+private:
+    /// The moving average that tracks the acceptance ratio
+    MovingAverage<bool> m_acceptanceRatio;
+
+    /// Whether the last proposal was accepted or not
+    bool m_lastProposalAccepted;
+
+    /// The penalty of a block parameter in the log-likelihood
+    double m_penalty;
+
+    /// The number of restricted Gibbs sweeps before the final one
+    int m_numIntermediateScans;
+
+    /// The vertices being reassigned in the current step
+    std::vector<int> m_vertices;
+
+    /// The original types of the vertices in \ref m_vertices in a merge
+    std::vector<int> m_originalTypes;
+
+public:
+    /// Constructor
+    /**
+     * \param  penalty               the penalty of a block parameter
+     * \param  numIntermediateScans  the number of restricted Gibbs sweeps
+     *                               before the final one
+     */
+    explicit MergeSplitStrategy(double penalty = 1.0, int numIntermediateScans = 3);
+
+    /// Returns the acceptance ratio
+    float getAcceptanceRatio() const {
+        return m_acceptanceRatio.value();
+    }
+
+    /// Returns the logarithm of the prior of the given number of groups
+    /**
+     * This is the penalty of the block parameters, up to a constant.
+     */
+    double getLogPrior(int numTypes) const {
+        return -m_penalty * numTypes * (numTypes + 1) / 2.0;
+    }
+
+    /// Returns the penalty of a block parameter
+    double getPenalty() const {
+        return m_penalty;
+    }
+
+    /// Sets the penalty of a block parameter
+    void setPenalty(double penalty) {
+        m_penalty = penalty;
+    }
+
+    /// Proposes a merge or a split and accepts or rejects it
+    virtual bool step(Blockmodel* pModel);
+
+    /// Returns whether the last proposal was accepted or not
+    bool wasLastProposalAccepted() const {
+        return m_lastProposalAccepted;
+    }
+
+private:
+    /// Proposes to merge the groups of the two given vertices
+    bool proposeMerge(Blockmodel* pModel, int vertex1, int vertex2);
+
+    /// Proposes to split the common group of the two given vertices
+    bool proposeSplit(Blockmodel* pModel, int vertex1, int vertex2);
+
+    /// Reassigns the vertices in \ref m_vertices between two groups
+    /**
+     * The vertices are assigned randomly to the two groups first, then the
+     * intermediate restricted Gibbs sweeps are done, followed by the final
+     * one. If \c targetTypes is not null, the final sweep moves every
+     * vertex to the given type instead of sampling it.
+     *
+     * \return  the log-probability of the outcome of the final sweep
+     */
+    double reassignVertices(Blockmodel* pModel, int type1, int type2,
+            const std::vector<int>* targetTypes);
+};
+
+/// Rejection-free (n-fold way) version of the Metropolis-Hastings sampler
+/**
+ * When almost every proposal of \ref MetropolisHastingsStrategy is
+ * rejected, most of the time is spent on evaluating moves that are never
+ * made. This strategy samples the next accepted move of the chain directly
+ * instead (Bortz, Kalos and Lebowitz, 1975) and returns the number of
+ * Metropolis-Hastings steps the chain would have needed to make it.
+ *
+ * In the Metropolis-Hastings chain, vertex i moves to group s in a step
+ * with probability \f$\min(1, \exp(\beta \Delta_{is})) / (nk)\f$, where
+ * \f$\Delta_{is}\f$ is the increase of the log-likelihood. Every move
+ * changes the edge counts of two groups, which affects the move
+ * probabilities of all the vertices slightly, so the exact rates cannot be
+ * kept up to date in less than O(nk) steps per move. The strategy therefore
+ * keeps an upper bound of the total move rate of every vertex in a Fenwick
+ * tree: the rate calculated when the vertex was last evaluated, multiplied
+ * by \f$\exp(\delta)\f$ for some margin \f$\delta\f$. A vertex is drawn
+ * proportionally to the bounds, its exact rates are calculated, and the
+ * vertex is accepted with the ratio of its exact rate and the bound
+ * (thinning); the new group is then drawn proportionally to the exact
+ * rates. The moved vertex and its neighbors, whose rates change the most,
+ * are re-evaluated after every move, and all the vertices are re-evaluated
+ * after a given number of moves.
+ *
+ * The sampler is approximate in general. The bounds are not proven to
+ * hold: the rate of a vertex that is not re-evaluated may grow by more
+ * than the margin before the next re-evaluation. Such a vertex is drawn
+ * less often than it should be, which biases the samples. The exceeded
+ * bounds that are found, either when their vertex is drawn or when all the
+ * vertices are re-evaluated, are counted by \ref getNumBoundViolations,
+ * and all the vertices are re-evaluated after a draw that exceeded its
+ * bound. The bias is largest on small graphs, where a single move changes
+ * the rates of the other vertices considerably. With a refresh period of
+ * one move, every bound is re-evaluated before the next draw and the
+ * sampler is exact.
+ *
+ * Every call to \ref step performs one draw, which may or may not move a
+ * vertex. The equivalent number of Metropolis-Hastings steps of the draw is
+ * sampled from the geometric distribution given by the bounds, so the state
+ * before the move would have been observed for \ref getLastWaitingTime - 1
+ * steps of the Metropolis-Hastings chain before the move.
+ */
+class RejectionFreeStrategy : public RandomizedOptimizationStrategy<Blockmodel> {
+private:
+    /// The upper bounds of the total move rates of the vertices
+    FenwickTree<double> m_bounds;
+
+    /// The inverse temperature of the chain
+    double m_inverseTemperature;
+
+    /// The logarithm of the factor between the bounds and the rates
+    double m_margin;
+
+    /// The number of moves between the re-evaluations of all the vertices
+    /**
+     * Zero means that the number of vertices is used.
+     */
+    long m_refreshPeriod;
+
+    /// The number of moves since the last re-evaluation of all the vertices
+    long m_numMovesSinceRefresh;
+
+    /// The number of draws since the last move
+    long m_numDrawsSinceMove;
+
+    /// The model for which the bounds were calculated
+    const Blockmodel* m_pLastModel;
+
+    /// The number of groups for which the bounds were calculated
+    int m_lastNumTypes;
+
+    /// The equivalent number of Metropolis-Hastings steps so far
+    double m_equivalentStepCount;
+
+    /// The equivalent number of Metropolis-Hastings steps of the last draw
+    long m_lastWaitingTime;
+
+    /// Whether the last draw moved a vertex
+    bool m_lastProposalAccepted;
+
+    /// The number of moves so far
+    long m_numMoves;
+
+    /// The number of exceeded bounds found so far
+    long m_numBoundViolations;
+
+    /// The move rates of the vertex being evaluated
+    igraph::Vector m_rates;
+
+    /// Scratch histogram used when the rates of a vertex are calculated
+    NeighborTypeHistogram m_histogram;
+
+public:
+    /// Constructor
+    /**
+     * \param  margin         the logarithm of the factor between the bounds
+     *                        and the rates
+     * \param  refreshPeriod  the number of moves between the re-evaluations
+     *                        of all the vertices; zero means the number of
+     *                        vertices
+     */
+    explicit RejectionFreeStrategy(double margin = 1.0, long refreshPeriod = 0);
+
+    /// Returns the fraction of the equivalent steps that moved a vertex
+    /**
+     * This is the acceptance ratio that the Metropolis-Hastings chain would
+     * have had so far.
+     */
+    float getAcceptanceRatio() const {
+        return m_equivalentStepCount > 0 ? m_numMoves / m_equivalentStepCount : 0.0;
+    }
+
+    /// Returns the equivalent number of Metropolis-Hastings steps so far
+    double getEquivalentStepCount() const {
+        return m_equivalentStepCount;
+    }
+
+    /// Returns the inverse temperature of the chain
+    double getInverseTemperature() const {
+        return m_inverseTemperature;
     }
 
+    /// Returns the equivalent number of Metropolis-Hastings steps of the last draw
+    long getLastWaitingTime() const {
+        return m_lastWaitingTime;
+    }
+
+    /// Returns the number of exceeded bounds found so far
+    /**
+     * A bound is checked when its vertex is drawn and when all the
+     * vertices are re-evaluated. A bound may also be exceeded temporarily
+     * and become valid again before it is checked, so this is a lower
+     * bound of the number of violations.
+     */
+    long getNumBoundViolations() const {
+        return m_numBoundViolations;
+    }
+
+    /// Forces the re-evaluation of all the vertices in the next step
+    /**
+     * This should be called when the model was modified by someone else
+     * than the strategy. Changes in the number of groups and switching to
+     * another model are detected automatically.
+     */
+    void reset() {
+        m_pLastModel = 0;
+    }
+
+    /// Sets the inverse temperature of the chain
+    void setInverseTemperature(double beta) {
+        m_inverseTemperature = beta;
+        reset();
+    }
+
+    /// Draws the next move of the chain and performs it if it is accepted
+    virtual bool step(Blockmodel* pModel);
+
+    /// Returns whether the last draw moved a vertex
+    bool wasLastProposalAccepted() const {
+        return m_lastProposalAccepted;
+    }
+
+private:
+    /// Calculates the move rates of a vertex into \ref m_rates
+    /**
+     * \return  the total move rate of the vertex
+     */
+    double calculateRates(const Blockmodel* pModel, long vertex);
+
+    /// Re-evaluates a vertex and updates its bound
+    void refreshVertex(const Blockmodel* pModel, long vertex);
+
+    /// Re-evaluates all the vertices and rebuilds the tree of the bounds
+    void refreshAll(const Blockmodel* pModel);
+};
+
+/// Cooling schedules of \ref SimulatedAnnealingStrategy
+typedef enum {
+    /// The temperature decreases by the same factor in every step
+    GEOMETRIC_COOLING,
+
+    /// The temperature decreases by the same amount in every step
+    LINEAR_COOLING,
+
+    /// The temperature is adjusted to follow a target acceptance ratio
+    ADAPTIVE_COOLING
+} CoolingSchedule;
+
+/// Simulated annealing for a blockmodel
+/**
+ * The strategy runs a Metropolis chain whose temperature is lowered from an
+ * initial to a final temperature in a given number of steps, followed by a
+ * zero-temperature quench with \ref WorklistGreedyStrategy that moves the
+ * vertices to their best groups until no move increases the log-likelihood.
+ * This finds a configuration with a high log-likelihood much faster than
+ * sampling at temperature 1 and waiting for the chain to reach it, but the
+ * result is a point estimate, not a sample from the likelihood distribution.
+ *
+ * In every step, a random vertex is moved to one of the other groups chosen
+ * uniformly, and the move is accepted with probability
+ * \f$\min(1, \exp(\Delta / T))\f$ where \f$\Delta\f$ is the increase of
+ * the log-likelihood and \f$T\f$ is the current temperature. The
+ * temperature after step t of N is
+ *
+ * - \f$T_0 (T_1 / T_0)^{t/N}\f$ for the geometric schedule,
+ * - \f$T_0 + (T_1 - T_0) t/N\f$ for the linear schedule.
+ *
+ * The adaptive schedule is the modified Lam schedule of Swartz (1993): the
+ * temperature is multiplied or divided by a constant factor after every step
+ * depending on whether the acceptance ratio of the recent steps is above or
+ * below a target. The target starts at 1, decreases to 0.44 in the first 15%
+ * of the steps, stays there until 65% of the steps and then decreases
+ * exponentially towards zero. The temperature is kept between the final
+ * and the initial temperature. It follows the acceptance ratio only, so it
+ * may still be above the final temperature at the end of the schedule; the
+ * quench finishes the cooling in that case.
+ */
+class SimulatedAnnealingStrategy : public RandomizedOptimizationStrategy<Blockmodel> {
+private:
+    /// The cooling schedule
+    CoolingSchedule m_schedule;
+
+    /// The temperature at the start of the annealing
+    double m_initialTemperature;
+
+    /// The temperature at the end of the annealing
+    double m_finalTemperature;
+
+    /// The number of annealing steps before the quench
+    long m_numSteps;
+
+    /// The current temperature
+    double m_temperature;
+
+    /// The moving average that tracks the acceptance ratio
+    MovingAverage<bool> m_acceptanceRatio;
+
+    /// Whether the last proposal was accepted or not
+    bool m_lastProposalAccepted;
+
+    /// Whether the quench was done already
+    bool m_finished;
+
+public:
+    /// Constructor
+    /**
+     * \param  schedule            the cooling schedule
+     * \param  initialTemperature  the temperature at the start
+     * \param  finalTemperature    the temperature at the end of the schedule
+     * \param  numSteps            the number of steps before the quench
+     */
+    SimulatedAnnealingStrategy(CoolingSchedule schedule = GEOMETRIC_COOLING,
+            double initialTemperature = 10.0, double finalTemperature = 0.01,
+            long numSteps = 1000000);
+
+    /// Returns the acceptance ratio of the recent steps
+    float getAcceptanceRatio() const {
+        return m_acceptanceRatio.value();
+    }
+
+    /// Returns the number of annealing steps before the quench
+    long getNumSteps() const {
+        return m_numSteps;
+    }
+
+    /// Returns the cooling schedule
+    CoolingSchedule getSchedule() const {
+        return m_schedule;
+    }
+
+    /// Returns the current temperature
+    double getTemperature() const {
+        return m_temperature;
+    }
+
+    /// Returns whether the annealing and the quench are finished
+    bool isFinished() const {
+        return m_finished;
+    }
+
+    /// Restarts the schedule from the initial temperature
+    void reset();
+
+    /// Runs one annealing step or the final quench
+    /**
+     * The quench is done by the step after the last annealing step.
+     *
+     * \return  false if the quench was done by this step or before, true
+     *          otherwise. \ref optimize therefore runs the whole schedule.
+     */
+    virtual bool step(Blockmodel* pModel);
+
     /// Returns whether the last proposal was accepted or not
     bool wasLastProposalAccepted() const {
         return m_lastProposalAccepted;
     }
+
+private:
+    /// Returns the target acceptance ratio of the adaptive schedule
+    double getTargetAcceptanceRatio() const;
+
+    /// Updates the temperature after a step
+    void updateTemperature();
 };
 
 /// Gibbs sampling for a blockmodel
 /**
  * In each step, a vertex is selected randomly and a new group is
- * proposed according to the log-likelihood conditioned on all but the
- * selected vertex.
+ * drawn from the log-likelihood conditioned on all but the selected
+ * vertex.
+ *
+ * The conditional distribution is calculated in a single pass: the
+ * log-likelihood increases of all the destinations come from one call to
+ * \ref Blockmodel::getLogLikelihoodIncreases, the maximum is subtracted
+ * before exponentiating so the largest weight is 1 and nothing overflows,
+ * and the new group is found by inverting the cumulative weights. All the
+ * intermediate results are kept in buffers that are reused between the
+ * steps, so a step does not allocate memory.
  */
 class GibbsSamplingStrategy : public RandomizedOptimizationStrategy<Blockmodel> {
+private:
+    /// The moving average that tracks the fraction of steps that moved a vertex
+    MovingAverage<bool> m_acceptanceRatio;
+
+    /// Whether the last step moved the vertex to another group
+    bool m_lastProposalAccepted;
+
+    /// The log-likelihood increases of the destinations of the current vertex
+    igraph::Vector m_increases;
+
+    /// Scratch histogram for the neighbor types of the current vertex
+    NeighborTypeHistogram m_histogram;
+
+    /// The cumulative weights of the destinations of the current vertex
+    std::vector<double> m_weights;
+
+    /// The order of the vertices in the sweeps
+    SweepOrder m_sweepOrder;
+
+    /// The random numbers of the current block of a sweep
+    std::vector<double> m_randomNumbers;
+
 public:
     /// Constructor
-    GibbsSamplingStrategy() : RandomizedOptimizationStrategy<Blockmodel>() {}
+    GibbsSamplingStrategy() : RandomizedOptimizationStrategy<Blockmodel>(),
+        m_acceptanceRatio(1000), m_lastProposalAccepted(false),
+        m_increases(), m_histogram(), m_weights(), m_sweepOrder(),
+        m_randomNumbers() {}
 
-    /// Returns the acceptance ratio
-    float getAcceptanceRatio() const { return 1.0; }
+    /// Returns the fraction of the recent steps that moved a vertex
+    /**
+     * Every draw of a Gibbs sampler is accepted, so this is the fraction
+     * of the draws that selected a group different from the current one.
+     */
+    float getAcceptanceRatio() const {
+        return m_acceptanceRatio.value();
+    }
 
     /// Advances the Markov chain by one step
     virtual bool step(Blockmodel* pModel) {
         int i = m_pRng->randint(pModel->getGraph()->vcount());
-        int oldType = pModel->getType(i);
-        long int k = pModel->getNumTypes();
-        igraph::Vector logLs(k);
-
-        // TODO: maybe this can be calculated more efficiently?
-        for (int j = 0; j < k; j++) {
-            PointMutation mutation(i, oldType, j);
-            logLs[j] = pModel->getLogLikelihoodIncrease(mutation);
-        }
+        updateVertex(pModel, i, m_pRng->random());
+        return true;
+    }
 
-        // Subtract the minimum log-likelihood from the log-likelihoods
-        logLs -= logLs.min();
+    /// Advances the Markov chain by a sweep over all the vertices
+    /**
+     * Every vertex gets one update in the order given by \ref SweepOrder,
+     * and the random numbers needed by a block of vertices are drawn in a
+     * single batch before the block. The step counter is increased by the
+     * number of vertices.
+     */
+    void sweep(Blockmodel* pModel) {
+        long numBlocks = startSweep(pModel);
+        for (long b = 0; b < numBlocks; b++)
+            sweepBlock(pModel, b);
+    }
 
-        // Run exp(), get cumulative sum
-        igraph::real_t (*igraph_exp)(igraph::real_t) = &std::exp;
-        std::transform(logLs.begin(), logLs.end(), logLs.begin(), igraph_exp);
-        std::partial_sum(logLs.begin(), logLs.end(), logLs.begin());
+    /// Starts a new sweep over all the vertices
+    /**
+     * \return  the number of blocks in the sweep; see
+     *          \ref MetropolisHastingsStrategy::startSweep
+     */
+    long startSweep(Blockmodel* pModel) {
+        m_sweepOrder.shuffle(pModel->getGraph()->vcount(), *m_pRng);
+        return m_sweepOrder.getNumBlocks();
+    }
 
-        // Select a new type based on the log-likelihood distribution
-        logLs.binsearch(m_pRng->random() * logLs.back(), &k);
-        pModel->setType(i, k);
+    /// Updates the vertices of the block at the given position of the current sweep
+    void sweepBlock(Blockmodel* pModel, long index) {
+        long start = m_sweepOrder.getBlockStart(index);
+        long end = m_sweepOrder.getBlockEnd(index);
 
-        stepDone();
+        fillRandomNumbers(m_randomNumbers, end - start);
+        for (long i = start; i < end; i++)
+            updateVertex(pModel, i, m_randomNumbers[i - start]);
+    }
 
-        return true;
+    /// Returns whether the last step moved the vertex to another group
+    bool wasLastProposalAccepted() const {
+        return m_lastProposalAccepted;
     }
 
-    /// Returns whether the last proposal was accepted or not
-    bool wasLastProposalAccepted() const { return true; }
+private:
+    /// Draws a new group for the given vertex from its conditional distribution
+    /**
+     * \param  pModel  the model
+     * \param  i       the vertex being updated
+     * \param  u       a uniform random number used to select the new group
+     */
+    void updateVertex(Blockmodel* pModel, long i, double u) {
+        int k = pModel->getNumTypes();
+        int oldType = pModel->getType(i), newType;
+
+        m_increases.resize(k);
+        m_weights.resize(k);
+        pModel->getLogLikelihoodIncreases(i, m_increases, m_histogram);
+
+        // Shift by the maximum so the exponentials are in (0, 1]. With the
+        // default flags (no -ffast-math), neither loop is vectorized: the
+        // maximum reduction needs -ffinite-math-only and -fno-signed-zeros,
+        // and the exponentials are scalar calls to std::exp
+        const double* increases = &m_increases[0];
+        double* weights = &m_weights[0];
+        double maxIncrease = increases[0];
+        for (int j = 1; j < k; j++)
+            maxIncrease = std::max(maxIncrease, increases[j]);
+        for (int j = 0; j < k; j++)
+            weights[j] = std::exp(increases[j] - maxIncrease);
+
+        // Invert the cumulative distribution
+        std::partial_sum(weights, weights + k, weights);
+        newType = std::upper_bound(weights, weights + k - 1, u * weights[k-1]) - weights;
+
+        m_lastProposalAccepted = (newType != oldType);
+        if (m_lastProposalAccepted)
+            pModel->performMutation(PointMutation(i, oldType, newType));
+        m_acceptanceRatio.push_back(m_lastProposalAccepted);
+
+        stepDone();
+    }
 };
 
 #endif
@@ -0,0 +1,35 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#ifndef BLOCKMODEL_PARALLEL_HPP
+#define BLOCKMODEL_PARALLEL_HPP
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+/// Returns the maximum number of threads that a parallel region may use
+/**
+ * This is always 1 if the library was compiled without OpenMP support.
+ */
+inline int getMaxThreadCount() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+/// Returns the index of the calling thread within the current parallel region
+/**
+ * This is always 0 outside parallel regions and if the library was compiled
+ * without OpenMP support.
+ */
+inline int getThreadIndex() {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+#endif
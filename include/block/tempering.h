@@ -0,0 +1,162 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#ifndef BLOCKMODEL_TEMPERING_H
+#define BLOCKMODEL_TEMPERING_H
+
+#include <vector>
+#include <block/blockmodel.h>
+#include <block/optimization.hpp>
+#include <igraph/cpp/vector.h>
+#include <mtwister/mt.h>
+
+/// Parallel tempering (replica exchange) sampler for blockmodels
+/**
+ * Parallel tempering runs several copies (replicas) of the same blockmodel
+ * with Metropolis-Hastings chains at different temperatures. The chain at
+ * temperature T samples from the likelihood distribution raised to the power
+ * of 1/T, so the hot chains move freely between the modes of the
+ * distribution while the coldest chain (T = 1) samples from the original
+ * distribution. After every round of steps, the states of neighboring
+ * temperatures are swapped with the probability
+ *
+ * \f[ \min(1, \exp((\beta_i - \beta_{i+1}) (L_{i+1} - L_i))) \f]
+ *
+ * where \f$\beta_i\f$ is the inverse temperature and \f$L_i\f$ is the
+ * log-likelihood of the replica at temperature i. This preserves the joint
+ * stationary distribution of the replicas and lets good configurations
+ * found by the hot chains trickle down to the cold one.
+ *
+ * The temperatures form a geometric ladder between a minimum and a maximum
+ * temperature. Every replica has its own random number generator seeded
+ * from the generator passed to \ref initialize, and the replicas are advanced
+ * in parallel if OpenMP is available. The result does not depend on the
+ * number of threads.
+ *
+ * The best model found by any of the replicas is kept track of.
+ */
+class ParallelTempering {
+private:
+    /// The replicas; element i is the one currently at temperature i
+    std::vector<Blockmodel*> m_replicas;
+
+    /// The Metropolis-Hastings samplers, one for each temperature
+    std::vector<MetropolisHastingsStrategy*> m_samplers;
+
+    /// The temperatures of the ladder in increasing order
+    std::vector<double> m_temperatures;
+
+    /// Best models found by the replicas in the current round
+    std::vector<Blockmodel*> m_roundBestModels;
+
+    /// Log-likelihoods of the models in \ref m_roundBestModels
+    std::vector<double> m_roundBestLogLs;
+
+    /// The best model found so far
+    Blockmodel* m_pBestModel;
+
+    /// The log-likelihood of the best model found so far
+    double m_bestLogL;
+
+    /// Random number generator used for the swap decisions
+    MersenneTwister m_rng;
+
+    /// The number of swaps proposed between temperatures i and i+1
+    std::vector<long> m_numSwapsProposed;
+
+    /// The number of swaps accepted between temperatures i and i+1
+    std::vector<long> m_numSwapsAccepted;
+
+    /// The number of rounds done so far
+    long m_numRounds;
+
+    /// Copying is not allowed as the object owns its replicas
+    ParallelTempering(const ParallelTempering&);
+
+    /// Assignment is not allowed as the object owns its replicas
+    ParallelTempering& operator=(const ParallelTempering&);
+
+public:
+    /// Constructs a parallel tempering sampler with no replicas
+    ParallelTempering();
+
+    /// Destructor
+    ~ParallelTempering();
+
+    /// Returns the best model found so far
+    const Blockmodel* getBestModel() const {
+        return m_pBestModel;
+    }
+
+    /// Returns the log-likelihood of the best model found so far
+    double getBestLogLikelihood() const {
+        return m_bestLogL;
+    }
+
+    /// Returns the number of replicas
+    int getNumReplicas() const {
+        return m_replicas.size();
+    }
+
+    /// Returns the replica currently at the given temperature index
+    /**
+     * Index zero is the coldest replica.
+     */
+    const Blockmodel* getReplica(int index) const {
+        return m_replicas[index];
+    }
+
+    /// Returns the sampler of the given temperature index
+    const MetropolisHastingsStrategy* getSampler(int index) const {
+        return m_samplers[index];
+    }
+
+    /// Returns the sampler of the given temperature index (non-const variant)
+    MetropolisHastingsStrategy* getSampler(int index) {
+        return m_samplers[index];
+    }
+
+    /// Returns the fraction of accepted swaps between temperatures i and i+1
+    /**
+     * The result is zero if no swaps were proposed yet.
+     */
+    double getSwapAcceptanceRate(int index) const;
+
+    /// Returns the temperature with the given index
+    double getTemperature(int index) const {
+        return m_temperatures[index];
+    }
+
+    /// Sets up the replicas and the temperature ladder
+    /**
+     * \param  pModel          the model whose copies will be the initial
+     *                         states of the replicas
+     * \param  numReplicas     the number of replicas; must be positive
+     * \param  minTemperature  the temperature of the coldest replica
+     * \param  maxTemperature  the temperature of the hottest replica
+     * \param  rng             random number generator used to seed the
+     *                         generators of the replicas
+     */
+    void initialize(const Blockmodel* pModel, int numReplicas,
+            double minTemperature, double maxTemperature, MersenneTwister& rng);
+
+    /// Runs a round of the given number of steps and proposes the swaps
+    /**
+     * Each replica is advanced by the given number of Metropolis-Hastings
+     * steps, then swaps are proposed between neighboring temperatures.
+     * Even and odd pairs of neighbors are tried in alternating rounds.
+     *
+     * \param  numSteps     the number of steps taken by each replica
+     * \param  coldSamples  if not null, the log-likelihoods of the coldest
+     *                      replica after each step are appended here
+     */
+    void runRound(long numSteps, igraph::Vector* coldSamples = 0);
+
+private:
+    /// Deletes all the replicas and samplers
+    void clear();
+
+    /// Proposes swaps between neighboring temperatures
+    void proposeSwaps();
+};
+
+#endif
@@ -0,0 +1,92 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#include <algorithm>
+#include <cmath>
+#include <block/optimization.hpp>
+
+SimulatedAnnealingStrategy::SimulatedAnnealingStrategy(CoolingSchedule schedule,
+        double initialTemperature, double finalTemperature, long numSteps)
+    : RandomizedOptimizationStrategy<Blockmodel>(), m_schedule(schedule),
+    m_initialTemperature(initialTemperature),
+    m_finalTemperature(finalTemperature), m_numSteps(numSteps),
+    m_temperature(initialTemperature), m_acceptanceRatio(500),
+    m_lastProposalAccepted(false), m_finished(false) {
+}
+
+double SimulatedAnnealingStrategy::getTargetAcceptanceRatio() const {
+    double fraction = static_cast<double>(m_stepCount) / m_numSteps;
+
+    if (fraction < 0.15)
+        return 0.44 + 0.56 * std::pow(560.0, -fraction / 0.15);
+    if (fraction < 0.65)
+        return 0.44;
+    return 0.44 * std::pow(440.0, -(fraction - 0.65) / 0.35);
+}
+
+void SimulatedAnnealingStrategy::reset() {
+    m_stepCount = 0;
+    m_temperature = m_initialTemperature;
+    m_acceptanceRatio.clear();
+    m_lastProposalAccepted = false;
+    m_finished = false;
+}
+
+bool SimulatedAnnealingStrategy::step(Blockmodel* pModel) {
+    int k = pModel->getNumTypes();
+
+    if (m_finished)
+        return false;
+
+    if (m_stepCount >= m_numSteps || k < 2) {
+        // Zero-temperature quench
+        WorklistGreedyStrategy<Blockmodel> greedy;
+        greedy.optimize(pModel);
+        m_finished = true;
+        return false;
+    }
+
+    // Propose one of the other groups so that every step is a real move
+    int i = m_pRng->randint(pModel->getGraph()->vcount());
+    int oldType = pModel->getType(i);
+    int newType = m_pRng->randint(k - 1);
+    if (newType >= oldType)
+        newType++;
+
+    PointMutation mutation(i, oldType, newType);
+    double logLDiff = pModel->getLogLikelihoodIncrease(mutation) / m_temperature;
+
+    m_lastProposalAccepted = (logLDiff >= 0) || (m_pRng->random() <= std::exp(logLDiff));
+    if (m_lastProposalAccepted)
+        pModel->performMutation(mutation);
+    m_acceptanceRatio.push_back(m_lastProposalAccepted);
+
+    stepDone();
+    updateTemperature();
+
+    return true;
+}
+
+void SimulatedAnnealingStrategy::updateTemperature() {
+    double fraction = std::min(1.0, static_cast<double>(m_stepCount) / m_numSteps);
+
+    switch (m_schedule) {
+        case GEOMETRIC_COOLING:
+            m_temperature = m_initialTemperature *
+                std::pow(m_finalTemperature / m_initialTemperature, fraction);
+            break;
+
+        case LINEAR_COOLING:
+            m_temperature = m_initialTemperature +
+                (m_finalTemperature - m_initialTemperature) * fraction;
+            break;
+
+        case ADAPTIVE_COOLING:
+            if (m_acceptanceRatio.value() > getTargetAcceptanceRatio())
+                m_temperature *= 0.999;
+            else
+                m_temperature /= 0.999;
+            m_temperature = std::max(m_finalTemperature,
+                    std::min(m_initialTemperature, m_temperature));
+            break;
+    }
+}
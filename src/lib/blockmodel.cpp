@@ -5,19 +5,56 @@
 #include <cmath>
 #include <stdexcept>
 #include <block/blockmodel.h>
+#include <block/math.hpp>
 #include <igraph/cpp/vertex_selector.h>
 
 using namespace igraph;
 
 namespace {
-    double binary_entropy(double prob) {
-        if (prob <= 0 || prob >= 1)
+    /* Log-likelihood term of a*b vertex pairs with e edges among them.
+     * This is a*b * H(e / (a*b)) where H is the binary entropy function,
+     * expanded into x*log(x) terms of integers so we can use the lookup
+     * table. The number of pairs is given by its factors, which are in the
+     * table even if the product is not. The term is zero without edges, so
+     * empty pairs of groups need no lookup at all. */
+    inline double entropy_term(long e, long a, long b) {
+        if (e == 0)
             return 0.0;
-        return prob * std::log(prob) + (1 - prob) * std::log(1 - prob);
+        return xlogx(e) + xlogx(a * b - e) - xlogx_product(a, b);
     }
 }
 
 
+/***************************************************************************/
+
+AdjacencyLists::AdjacencyLists(const Graph& graph) : offsets(), neighbors() {
+    long i, n = graph.vcount();
+    Vector edgelist = graph.getEdgelist();
+    Vector::const_iterator it;
+    std::vector<int> pos;
+
+    // Count the degrees first, then turn them into offsets
+    offsets.resize(n+1, 0);
+    for (it = edgelist.begin(); it != edgelist.end(); it++)
+        offsets[static_cast<long>(*it) + 1]++;
+    for (i = 0; i < n; i++)
+        offsets[i+1] += offsets[i];
+
+    // Fill the neighbor lists. Loop edges appear twice in the neighbor
+    // list of their vertex, just like in Graph::neighbors()
+    neighbors.resize(edgelist.size());
+    pos.assign(offsets.begin(), offsets.end() - 1);
+    for (it = edgelist.begin(); it != edgelist.end(); it += 2) {
+        long from = *it, to = *(it+1);
+        neighbors[pos[from]++] = to;
+        neighbors[pos[to]++] = from;
+    }
+
+    // Sort the neighbor lists to get the same order as Graph::neighbors()
+    for (i = 0; i < n; i++)
+        std::sort(neighbors.begin() + offsets[i], neighbors.begin() + offsets[i+1]);
+}
+
 /***************************************************************************/
 
 void PointMutation::perform(Blockmodel& model) const {
@@ -40,22 +77,41 @@ void PointMutation::undo(Blockmodel& model) const {
 
 /***************************************************************************/
 
+void GroupMutation::perform(Blockmodel& model) const {
+    if (to == model.getNumTypes())
+        model.setNumTypes(to + 1);
+
+    for (std::vector<int>::const_iterator it = vertices.begin();
+         it != vertices.end(); it++)
+        model.performMutation(PointMutation(*it, from, to));
+
+    if (model.getTypeCount(from) == 0)
+        model.removeEmptyType(from);
+}
+
+/***************************************************************************/
+
 void Blockmodel::getEdgeCountsFromAffectedGroupsAfter(
         const PointMutation& mutation,
         igraph::Vector& countsFrom, igraph::Vector& countsTo) const {
-    m_edgeCounts.getRow(mutation.from, countsFrom);
-    m_edgeCounts.getCol(mutation.to, countsTo);
+    const long* edgesFrom = m_edgeCounts.row(mutation.from);
+    const long* edgesTo = m_edgeCounts.row(mutation.to);
+
+    countsFrom.resize(m_numTypes);
+    countsTo.resize(m_numTypes);
+    for (int i = 0; i < m_numTypes; i++) {
+        countsFrom[i] = edgesFrom[i];
+        countsTo[i] = edgesTo[i];
+    }
 
     if (mutation.from == mutation.to)
         return;
 
-    // Get the neighbors of the affected vertex
-    Vector neighbors = m_pGraph->neighbors(mutation.vertex);
-
-    // Adjust countsFrom and countsTo accordingly
-    for (Vector::const_iterator it = neighbors.begin();
-         it != neighbors.end(); it++) {
-        long otherType = m_types[*it];
+    // Adjust countsFrom and countsTo according to the neighbors of the
+    // affected vertex
+    const int* end = getNeighborsEnd(mutation.vertex);
+    for (const int* it = getNeighborsBegin(mutation.vertex); it != end; it++) {
+        int otherType = m_types[*it];
         countsFrom[otherType]--;
         countsTo[otherType]++;
         if (otherType == mutation.from) {
@@ -68,6 +124,14 @@ void Blockmodel::getEdgeCountsFromAffectedGroupsAfter(
     }
 }
 
+Matrix Blockmodel::getEdgeCounts() const {
+    Matrix result(m_numTypes, m_numTypes);
+    for (int i = 0; i < m_numTypes; i++)
+        for (int j = 0; j < m_numTypes; j++)
+            result(i, j) = m_edgeCounts(i, j);
+    return result;
+}
+
 double Blockmodel::getLogLikelihoodIncrease(
         const PointMutation& mutation) {
     double result = -getLogLikelihood();
@@ -78,34 +142,39 @@ double Blockmodel::getLogLikelihoodIncrease(
 }
 
 long int Blockmodel::getTotalEdgesBetweenGroups(int type1, int type2) const {
+    long int count1 = m_typeCounts[type1];
     if (type1 == type2)
-        return (m_typeCounts[type1] - 1) * m_typeCounts[type1];
-    return m_typeCounts[type1] * m_typeCounts[type2];
+        return (count1 - 1) * count1;
+    return count1 * m_typeCounts[type2];
 }
 
 void Blockmodel::getTotalEdgesFromGroup(int type, Vector& result) const {
-    result = m_typeCounts[type] * m_typeCounts;
-    result[type] -= m_typeCounts[type];
+    double count = m_typeCounts[type];
+
+    result.resize(m_numTypes);
+    for (int i = 0; i < m_numTypes; i++)
+        result[i] = count * m_typeCounts[i];
+    result[type] -= count;
 }
 
 void Blockmodel::getTotalEdgesFromAffectedGroupsAfter(
         const PointMutation& mutation,
         Vector& countsFrom, Vector& countsTo) const {
-    countsFrom = m_typeCounts[mutation.from] * m_typeCounts;
-    countsFrom[mutation.from] -= m_typeCounts[mutation.from];
+    getTotalEdgesFromGroup(mutation.from, countsFrom);
 
     if (mutation.from == mutation.to) {
         countsTo = countsFrom;
         return;
     }
 
-    countsTo = m_typeCounts[mutation.to] * m_typeCounts;
-    countsTo[mutation.to] -= m_typeCounts[mutation.to];
+    getTotalEdgesFromGroup(mutation.to, countsTo);
 
     // We take into account the point mutation from here
-    countsFrom -= m_typeCounts;
+    for (int i = 0; i < m_numTypes; i++) {
+        countsFrom[i] -= m_typeCounts[i];
+        countsTo[i] += m_typeCounts[i];
+    }
     countsFrom[mutation.from] -= m_typeCounts[mutation.from];
-    countsTo += m_typeCounts;
     countsTo[mutation.to] += m_typeCounts[mutation.to];
 
     countsFrom[mutation.from] += 2;
@@ -113,8 +182,74 @@ void Blockmodel::getTotalEdgesFromAffectedGroupsAfter(
     countsTo[mutation.from] -= m_typeCounts[mutation.to]+1;
 }
 
+Vector Blockmodel::getTypes() const {
+    Vector result(m_types.size());
+    for (size_t i = 0; i < m_types.size(); i++)
+        result[i] = m_types[i];
+    return result;
+}
+
+Vector Blockmodel::getTypeCounts() const {
+    Vector result(m_numTypes);
+    for (int i = 0; i < m_numTypes; i++)
+        result[i] = m_typeCounts[i];
+    return result;
+}
+
+void Blockmodel::countNeighborTypes(long index,
+        NeighborTypeHistogram& histogram) const {
+    histogram.reserve(m_numTypes);
+
+    if (m_neighborTypeCacheEnabled) {
+        const int* types = getCachedNeighborTypes(index);
+        const int* counts = getCachedNeighborTypeCounts(index);
+        int num = m_numCachedNeighborTypes[index];
+        for (int j = 0; j < num; j++) {
+            histogram.counts[types[j]] = counts[j];
+            histogram.types.push_back(types[j]);
+        }
+        return;
+    }
+
+    const int* end = getNeighborsEnd(index);
+    for (const int* it = getNeighborsBegin(index); it != end; it++) {
+        int type = m_types[*it];
+        if (histogram.counts[type]++ == 0)
+            histogram.types.push_back(type);
+    }
+}
+
+void Blockmodel::mergeTypes(int type1, int type2) {
+    if (type1 == type2)
+        throw std::invalid_argument("cannot merge a group with itself");
+
+    GroupMutation mutation(std::max(type1, type2), std::min(type1, type2));
+    for (size_t i = 0; i < m_types.size(); i++) {
+        if (m_types[i] == mutation.from)
+            mutation.vertices.push_back(i);
+    }
+
+    // Group mutation.from becomes empty, so it is also removed
+    mutation.perform(*this);
+}
+
+void Blockmodel::removeEmptyType(int type) {
+    if (m_typeCounts[type] != 0)
+        throw std::invalid_argument("only empty groups can be removed");
+
+    int lastType = m_numTypes - 1;
+    if (type != lastType) {
+        for (size_t i = 0; i < m_types.size(); i++) {
+            if (m_types[i] == lastType)
+                performMutation(PointMutation(i, lastType, type));
+        }
+    }
+
+    setNumTypes(lastType);
+}
+
 void Blockmodel::randomize(MersenneTwister& rng) {
-    for (Vector::iterator it = m_types.begin(); it != m_types.end(); it++)
+    for (std::vector<int>::iterator it = m_types.begin(); it != m_types.end(); it++)
         *it = rng.randint(m_numTypes);
     // Invalidate the log-likelihood cache
     invalidateCache();
@@ -122,50 +257,139 @@ void Blockmodel::randomize(MersenneTwister& rng) {
     recountEdges();
 }
 
+void Blockmodel::rebuildNeighborLists() {
+    if (m_pGraph == NULL) {
+        m_pAdjacency.reset();
+        m_neighborOffsets = 0;
+        m_neighbors = 0;
+        return;
+    }
+
+    m_pAdjacency.reset(new AdjacencyLists(*m_pGraph));
+    m_neighborOffsets = &m_pAdjacency->offsets[0];
+    m_neighbors = m_pAdjacency->neighbors.empty() ? 0 : &m_pAdjacency->neighbors[0];
+}
+
+void Blockmodel::rebuildNeighborTypeCache() {
+    if (!m_neighborTypeCacheEnabled)
+        return;
+
+    if (m_pGraph == NULL || m_numTypes == 0) {
+        m_cachedNeighborTypes.clear();
+        m_cachedNeighborTypeCounts.clear();
+        m_numCachedNeighborTypes.clear();
+        return;
+    }
+
+    long n = m_pGraph->vcount();
+
+    m_cachedNeighborTypes.resize(m_pAdjacency->neighbors.size());
+    m_cachedNeighborTypeCounts.resize(m_pAdjacency->neighbors.size());
+    m_numCachedNeighborTypes.resize(n);
+
+    // We cannot use countNeighborTypes() here as it would read the cache
+    m_histogram.reserve(m_numTypes);
+    for (long i = 0; i < n; i++) {
+        const int* end = getNeighborsEnd(i);
+        for (const int* it = getNeighborsBegin(i); it != end; it++) {
+            int type = m_types[*it];
+            if (m_histogram.counts[type]++ == 0)
+                m_histogram.types.push_back(type);
+        }
+
+        long offset = m_neighborOffsets[i];
+        m_numCachedNeighborTypes[i] = m_histogram.types.size();
+        for (size_t j = 0; j < m_histogram.types.size(); j++) {
+            m_cachedNeighborTypes[offset + j] = m_histogram.types[j];
+            m_cachedNeighborTypeCounts[offset + j] =
+                m_histogram.counts[m_histogram.types[j]];
+        }
+
+        m_histogram.clear();
+    }
+}
+
 void Blockmodel::recountEdges() {
-    if (m_pGraph == NULL)
+    // Nothing to count if there is no graph or setNumTypes() has not been
+    // called yet; the latter will call us again anyway
+    if (m_pGraph == NULL || m_numTypes == 0)
         return;
 
     long n = m_pGraph->vcount();
-    Vector edgelist = m_pGraph->getEdgelist();
-    Vector::const_iterator it = edgelist.begin();
 
     m_typeCounts.fill(0);
     for (long i = 0; i < n; i++) {
         m_typeCounts[m_types[i]]++;
     }
 
+    // Every edge is seen once from both of its endpoints, so this adds one
+    // to both (type1, type2) and (type2, type1) for every edge, as well as
+    // two to (type1, type1) for edges within the same type
     m_edgeCounts.fill(0);
-    while (it != edgelist.end()) {
-        long type1 = m_types[*(it++)];
-        long type2 = m_types[*(it++)];
-        m_edgeCounts(type1,type2) += 1;
-        m_edgeCounts(type2,type1) += 1;
+    m_sumOfDegreesByType.assign(m_numTypes, 0);
+    for (long i = 0; i < n; i++) {
+        int type1 = m_types[i];
+        const int* end = getNeighborsEnd(i);
+        for (const int* it = getNeighborsBegin(i); it != end; it++) {
+            m_edgeCounts(type1, m_types[*it]) += 1;
+        }
+        m_sumOfDegreesByType[type1] += getDegree(i);
     }
+
+    rebuildNeighborTypeCache();
 }
 
 void Blockmodel::setGraph(igraph::Graph* graph) {
-    size_t oldSize = m_types.size();
-
     m_pGraph = graph;
+    rebuildNeighborLists();
+
     if (m_pGraph != NULL) {
-        m_types.resize(m_pGraph->vcount());
-        for (; oldSize < m_types.size(); oldSize++)
-            m_types[oldSize] = 0;
+        m_types.resize(m_pGraph->vcount(), 0);
         recountEdges();
     }
 }
 
+void Blockmodel::setNeighborTypeCacheEnabled(bool enabled) {
+    if (m_neighborTypeCacheEnabled == enabled)
+        return;
+
+    m_neighborTypeCacheEnabled = enabled;
+    if (enabled) {
+        rebuildNeighborTypeCache();
+    } else {
+        // Release the memory as well
+        std::vector<int>().swap(m_cachedNeighborTypes);
+        std::vector<int>().swap(m_cachedNeighborTypeCounts);
+        std::vector<int>().swap(m_numCachedNeighborTypes);
+    }
+}
+
 void Blockmodel::setNumTypes(int numTypes) {
     if (numTypes <= 0)
         throw std::runtime_error("must have at least one type");
 
+    // The counts can be kept if only empty groups are removed
+    bool keepCounts = (m_pGraph != NULL && m_numTypes > 0);
+    for (int i = numTypes; keepCounts && i < m_numTypes; i++)
+        keepCounts = (m_typeCounts[i] == 0);
+
+    if (keepCounts) {
+        m_numTypes = numTypes;
+        m_typeCounts.resizeAndKeep(1, numTypes);
+        m_edgeCounts.resizeAndKeep(numTypes, numTypes);
+        m_sumOfDegreesByType.resize(numTypes, 0);
+        m_histogram.reserve(numTypes);
+        return;
+    }
+
     m_numTypes = numTypes;
-    m_typeCounts.resize(numTypes);
+    m_typeCounts.resize(1, numTypes);
     if (m_pGraph != NULL)
-        m_typeCounts[0] += m_pGraph->vcount() - m_typeCounts.sum();
+        m_typeCounts[0] = m_pGraph->vcount();
 
     m_edgeCounts.resize(numTypes, numTypes);
+    m_sumOfDegreesByType.assign(numTypes, 0);
+    m_histogram.reserve(numTypes);
     recountEdges();
 }
 
@@ -174,18 +398,25 @@ void Blockmodel::setType(long index, int newType) {
     int oldType = m_types[index];
     if (oldType == newType)
         return;
-    // Get the neighbors of the affected vertex
-    Vector neighbors = m_pGraph->neighbors(index);
-    // Adjust the edge counts and the type counts
-    // Here we assume that there are no loop edges
+    // Adjust the edge counts and the type counts. The neighbors are
+    // counted by type first so every affected pair of groups is updated
+    // only once. Here we assume that there are no loop edges
     m_typeCounts[oldType]--; m_typeCounts[newType]++;
-    for (Vector::const_iterator it = neighbors.begin();
-         it != neighbors.end(); it++) {
-        long otherType = m_types[*it];
-        m_edgeCounts(oldType, otherType)--;
-        m_edgeCounts(otherType, oldType)--;
-        m_edgeCounts(newType, otherType)++;
-        m_edgeCounts(otherType, newType)++;
+    m_sumOfDegreesByType[oldType] -= getDegree(index);
+    m_sumOfDegreesByType[newType] += getDegree(index);
+    countNeighborTypes(index, m_histogram);
+    for (std::vector<int>::const_iterator it = m_histogram.types.begin();
+         it != m_histogram.types.end(); it++) {
+        int count = m_histogram.counts[*it];
+        m_edgeCounts.addSymmetric(oldType, *it, -count);
+        m_edgeCounts.addSymmetric(newType, *it, count);
+    }
+    m_histogram.clear();
+    // Adjust the neighbor type histograms of the neighbors
+    if (m_neighborTypeCacheEnabled) {
+        const int* end = getNeighborsEnd(index);
+        for (const int* it = getNeighborsBegin(index); it != end; it++)
+            updateNeighborTypeCache(*it, oldType, newType);
     }
     // Set the type of the vertex to the new type
     m_types[index] = newType;
@@ -193,13 +424,44 @@ void Blockmodel::setType(long index, int newType) {
     invalidateCache();
 }
 
+void Blockmodel::updateNeighborTypeCache(long index, int oldType, int newType) {
+    int* types = &m_cachedNeighborTypes[0] + m_neighborOffsets[index];
+    int* counts = &m_cachedNeighborTypeCounts[0] + m_neighborOffsets[index];
+    int& num = m_numCachedNeighborTypes[index];
+    int j;
+
+    // Decrease the count of the old type; if it drops to zero, move the
+    // last entry of the histogram in its place
+    for (j = 0; j < num; j++) {
+        if (types[j] == oldType) {
+            if (--counts[j] == 0) {
+                num--;
+                types[j] = types[num];
+                counts[j] = counts[num];
+            }
+            break;
+        }
+    }
+
+    // Increase the count of the new type, adding it if needed
+    for (j = 0; j < num; j++) {
+        if (types[j] == newType) {
+            counts[j]++;
+            return;
+        }
+    }
+    types[num] = newType;
+    counts[num] = 1;
+    num++;
+}
+
 void Blockmodel::setTypes(const Vector& types) {
     if (types.min() < 0)
         throw std::runtime_error("negative type index found in type vector");
     if (types.max() >= m_numTypes)
         throw std::runtime_error("too large type index found in type vector");
 
-    m_types = types;
+    m_types.assign(types.begin(), types.end());
     // Invalidate the log-likelihood cache
     invalidateCache();
     // Recount the edges
@@ -228,81 +490,184 @@ Graph UndirectedBlockmodel::generate(MersenneTwister& rng) const {
     return graph;
 }
 
+double UndirectedBlockmodel::getLogLikelihoodTerm(int type1, int type2) const {
+    long count1 = m_typeCounts[type1];
+
+    if (type1 == type2)
+        return entropy_term(m_edgeCounts(type1, type1), count1, count1 - 1) / 2;
+
+    return entropy_term(m_edgeCounts(type1, type2), count1, m_typeCounts[type2]);
+}
+
+double UndirectedBlockmodel::getMergeLogLikelihoodIncrease(
+        int type1, int type2) const {
+    if (type1 == type2)
+        return 0.0;
+
+    long count = m_typeCounts[type1] + m_typeCounts[type2];
+    double result = 0.0;
+
+    // The pairs of the merged group with the other groups
+    for (int i = 0; i < m_numTypes; i++) {
+        if (i == type1 || i == type2 || m_typeCounts[i] == 0)
+            continue;
+        result += entropy_term(m_edgeCounts(type1, i) + m_edgeCounts(type2, i),
+                count, m_typeCounts[i]);
+        result -= getLogLikelihoodTerm(type1, i) + getLogLikelihoodTerm(type2, i);
+    }
+
+    // The merged group with itself; the diagonal counts are doubled
+    result += entropy_term(m_edgeCounts(type1, type1) +
+            m_edgeCounts(type2, type2) + 2 * m_edgeCounts(type1, type2),
+            count, count - 1) / 2;
+    result -= getLogLikelihoodTerm(type1, type1) +
+        getLogLikelihoodTerm(type2, type2) + getLogLikelihoodTerm(type1, type2);
+
+    return result;
+}
+
 double UndirectedBlockmodel::recalculateLogLikelihood() const {
-    double den, result = 0.0;
+    double term, result = 0.0;
+
+    m_logLikelihoodTerms.resize(m_numTypes, m_numTypes);
+    m_logLikelihoodTerms.fill(0);
 
     for (int i = 0; i < m_numTypes; i++) {
         if (m_typeCounts[i] == 0)
             continue;
 
         for (int j = i+1; j < m_numTypes; j++) {
-            den = getTotalEdgesBetweenGroups(i, j);
-            if (den == 0)
-                continue;
-            result += den * binary_entropy(m_edgeCounts(i, j) / den);
+            term = getLogLikelihoodTerm(i, j);
+            m_logLikelihoodTerms(i, j) = m_logLikelihoodTerms(j, i) = term;
+            result += term;
         }
 
-        den = getTotalEdgesBetweenGroups(i, i);
-        if (den == 0)
-            continue;
-        result += (den/2) * binary_entropy(m_edgeCounts(i, i) / den);
+        term = getLogLikelihoodTerm(i, i);
+        m_logLikelihoodTerms(i, i) = term;
+        result += term;
     }
 
+    m_logLikelihoodTermsValid = (m_pGraph != NULL);
+    m_driftCounter = 0;
+
     m_logLikelihood = result;
     return result;
 }
 
+void UndirectedBlockmodel::recountEdges() {
+    Blockmodel::recountEdges();
+    m_logLikelihoodTermsValid = false;
+}
+
 double UndirectedBlockmodel::getLogLikelihoodIncrease(
         const PointMutation& mutation) {
-    double result = 0.0;
+    int r = mutation.from, s = mutation.to;
 
-    if (mutation.from == mutation.to)
-        return result;
+    if (r == s)
+        return 0.0;
 
-    /* Get the old probabilities and counts */
+    // Count the neighbors of the vertex by type in the scratch row
+    countNeighborTypes(mutation.vertex, m_histogram);
+    const double* neiCounts = &m_histogram.counts[0];
 
-    Vector oldProbsFrom(m_numTypes),  oldProbsTo(m_numTypes);
-    Vector oldCountsFrom(m_numTypes), oldCountsTo(m_numTypes);
+    // The edge count matrix is symmetric, so row r is also column r
+    const int* typeCounts = m_typeCounts.row(0);
+    const long* edgesR = m_edgeCounts.row(r);
+    const long* edgesS = m_edgeCounts.row(s);
+    double nr = typeCounts[r], ns = typeCounts[s];
+    double hr = neiCounts[r], hs = neiCounts[s];
+    double result = 0.0;
 
-    getTotalEdgesFromGroup(mutation.from, oldCountsFrom);
-    getTotalEdgesFromGroup(mutation.to,   oldCountsTo);
-    getProbabilitiesFromGroup(mutation.from, oldProbsFrom);
-    getProbabilitiesFromGroup(mutation.to,   oldProbsTo);
+    // Single pass over the rows of groups r and s. This treats every column
+    // as if it belonged to a third group; columns r and s are fixed below.
+    for (int t = 0; t < m_numTypes; t++) {
+        double nt = typeCounts[t], h = neiCounts[t];
+        result += entropy_term(edgesR[t] - h, nr-1, nt)
+                - entropy_term(edgesR[t], nr, nt)
+                + entropy_term(edgesS[t] + h, ns+1, nt)
+                - entropy_term(edgesS[t], ns, nt);
+    }
 
-    /* Get the new probabilities and counts */
+    // Remove what the loop added for columns r and s...
+    result -= entropy_term(edgesR[r] - hr, nr-1, nr)
+            - entropy_term(edgesR[r], nr, nr)
+            + entropy_term(edgesS[r] + hr, ns+1, nr)
+            - entropy_term(edgesS[r], ns, nr);
+    result -= entropy_term(edgesR[s] - hs, nr-1, ns)
+            - entropy_term(edgesR[s], nr, ns)
+            + entropy_term(edgesS[s] + hs, ns+1, ns)
+            - entropy_term(edgesS[s], ns, ns);
+
+    // ...and add the correct terms for the pairs (r, r), (s, s) and (r, s).
+    // Diagonal elements contain twice the number of edges and vertex pairs.
+    result += (entropy_term(edgesR[r] - 2*hr, nr-1, nr-2)
+             - entropy_term(edgesR[r], nr, nr-1)) / 2;
+    result += (entropy_term(edgesS[s] + 2*hs, ns+1, ns)
+             - entropy_term(edgesS[s], ns, ns-1)) / 2;
+    result += entropy_term(edgesR[s] + hr - hs, nr-1, ns+1)
+            - entropy_term(edgesR[s], nr, ns);
+
+    m_histogram.clear();
 
-    Vector newCountsFrom(m_numTypes), newCountsTo(m_numTypes);
-    Vector newProbsFrom(m_numTypes),  newProbsTo(m_numTypes);
+    return result;
+}
 
-    getTotalEdgesFromAffectedGroupsAfter(mutation, newCountsFrom, newCountsTo);
-    getEdgeCountsFromAffectedGroupsAfter(mutation, newProbsFrom,  newProbsTo);
-    for (int i = 0; i < m_numTypes; i++) {
-        if (newCountsFrom[i] > 0)
-            newProbsFrom[i] /= newCountsFrom[i];
-        if (newCountsTo[i] > 0)
-            newProbsTo[i] /= newCountsTo[i];
+void UndirectedBlockmodel::getLogLikelihoodIncreases(long index,
+        Vector& result, NeighborTypeHistogram& histogram) const {
+    int r = m_types[index];
+
+    result.resize(m_numTypes);
+    countNeighborTypes(index, histogram);
+
+    const double* neiCounts = &histogram.counts[0];
+    const int* typeCounts = m_typeCounts.row(0);
+    const long* edgesR = m_edgeCounts.row(r);
+    double nr = typeCounts[r], hr = neiCounts[r];
+    double sumR = 0.0, diffRR, diffR, diffS, diffRS;
+
+    // First we calculate how the terms in row r change when the vertex
+    // leaves group r. This does not depend on the destination group, so
+    // we can store them in the result vector temporarily.
+    for (int t = 0; t < m_numTypes; t++) {
+        double nt = typeCounts[t];
+        result[t] = entropy_term(edgesR[t] - neiCounts[t], nr-1, nt)
+                  - entropy_term(edgesR[t], nr, nt);
+        sumR += result[t];
     }
+    diffR = sumR - result[r];
+    diffRR = (entropy_term(edgesR[r] - 2*hr, nr-1, nr-2)
+            - entropy_term(edgesR[r], nr, nr-1)) / 2;
+
+    // Now, for each destination group s, add the change in row s. The
+    // pairs (r, r), (s, s) and (r, s) are treated separately.
+    for (int s = 0; s < m_numTypes; s++) {
+        if (s == r) {
+            result[s] = 0.0;
+            continue;
+        }
 
-    /* Correct the diagonal elements in oldCounts* and newCounts* as they
-     * contain twice the number of edges there */
-    oldCountsFrom[mutation.from] /= 2;
-    oldCountsTo[mutation.to] /= 2;
-    newCountsFrom[mutation.from] /= 2;
-    newCountsTo[mutation.to] /= 2;
+        const long* edgesS = m_edgeCounts.row(s);
+        double ns = typeCounts[s], hs = neiCounts[s];
 
-    /* Calculate the increase */
-    for (int i = 0; i < m_numTypes; i++) {
-        result += newCountsFrom[i] * binary_entropy(newProbsFrom[i]);
-        result -= oldCountsFrom[i] * binary_entropy(oldProbsFrom[i]);
-        result += newCountsTo  [i] * binary_entropy(newProbsTo  [i]);
-        result -= oldCountsTo  [i] * binary_entropy(oldProbsTo  [i]);
+        diffS = 0.0;
+        for (int t = 0; t < m_numTypes; t++) {
+            double nt = typeCounts[t];
+            diffS += entropy_term(edgesS[t] + neiCounts[t], ns+1, nt)
+                   - entropy_term(edgesS[t], ns, nt);
+        }
+        diffS -= entropy_term(edgesS[r] + hr, ns+1, nr)
+               - entropy_term(edgesS[r], ns, nr);
+        diffS -= entropy_term(edgesS[s] + hs, ns+1, ns)
+               - entropy_term(edgesS[s], ns, ns);
+        diffS += (entropy_term(edgesS[s] + 2*hs, ns+1, ns)
+                - entropy_term(edgesS[s], ns, ns-1)) / 2;
+        diffRS = entropy_term(edgesR[s] + hr - hs, nr-1, ns+1)
+               - entropy_term(edgesR[s], nr, ns);
+
+        result[s] = diffR - result[s] + diffRR + diffS + diffRS;
     }
-    result -= newCountsFrom[mutation.to] *
-              binary_entropy(newProbsFrom[mutation.to]);
-    result += oldCountsFrom[mutation.to] *
-              binary_entropy(oldProbsFrom[mutation.to]);
 
-    return result;
+    histogram.clear();
 }
 
 double UndirectedBlockmodel::getProbability(int type1, int type2) const {
@@ -366,7 +731,20 @@ void UndirectedBlockmodel::getProbabilitiesFromGroup(int type,
 }
 
 void UndirectedBlockmodel::setNumTypes(int numTypes) {
+    int oldNumTypes = m_numTypes;
+
     Blockmodel::setNumTypes(numTypes);
+
+    // The terms of the remaining groups are still valid if the edges were
+    // not recounted; the terms of empty groups are zero
+    if (m_logLikelihoodTermsValid) {
+        int commonNumTypes = std::min(oldNumTypes, numTypes);
+        Matrix terms(numTypes, numTypes);
+        for (int i = 0; i < commonNumTypes; i++)
+            for (int j = 0; j < commonNumTypes; j++)
+                terms(i, j) = m_logLikelihoodTerms(i, j);
+        m_logLikelihoodTerms = terms;
+    }
     if (m_pGraph != NULL)
         m_probabilities.resize(0, 0);
     else
@@ -379,6 +757,51 @@ void UndirectedBlockmodel::setProbabilities(const Matrix& p) {
     m_probabilities = p;
 }
 
+void UndirectedBlockmodel::setType(long index, int newType) {
+    int oldType = m_types[index];
+    double oldLogLikelihood = m_logLikelihood;
+
+    Blockmodel::setType(index, newType);
+    if (oldType == newType || !m_logLikelihoodTermsValid)
+        return;
+
+    double increase = updateLogLikelihoodTerms(oldType, newType);
+    if (m_driftCounter < 8192) {
+        m_logLikelihood = oldLogLikelihood + increase;
+        m_driftCounter++;
+    } else {
+        double sum = 0.0;
+        for (int i = 0; i < m_numTypes; i++)
+            for (int j = i; j < m_numTypes; j++)
+                sum += m_logLikelihoodTerms(i, j);
+        m_logLikelihood = sum;
+        m_driftCounter = 0;
+    }
+}
+
+double UndirectedBlockmodel::updateLogLikelihoodTerms(int type1, int type2) {
+    double oldTerm, newTerm, result = 0.0;
+
+    // Only the pairs involving type1 or type2 are affected. The pair
+    // (type1, type2) is updated in the first loop only.
+    for (int i = 0; i < m_numTypes; i++) {
+        oldTerm = m_logLikelihoodTerms(type1, i);
+        newTerm = getLogLikelihoodTerm(type1, i);
+        m_logLikelihoodTerms(type1, i) = m_logLikelihoodTerms(i, type1) = newTerm;
+        result += newTerm - oldTerm;
+    }
+    for (int i = 0; i < m_numTypes; i++) {
+        if (i == type1)
+            continue;
+        oldTerm = m_logLikelihoodTerms(type2, i);
+        newTerm = getLogLikelihoodTerm(type2, i);
+        m_logLikelihoodTerms(type2, i) = m_logLikelihoodTerms(i, type2) = newTerm;
+        result += newTerm - oldTerm;
+    }
+
+    return result;
+}
+
 /***************************************************************************/
 
 namespace {
@@ -423,8 +846,8 @@ Graph DegreeCorrectedUndirectedBlockmodel::generate(
 
 /* Auxiliary functions for getLogLikelihoodIncrease */
 namespace {
-	inline double b(double x) {
-		return x == 0 ? 0 : x*(std::log(x) - 1);
+	inline double b(long x) {
+		return xlogx(x) - x;
 	}
 }
 
@@ -435,82 +858,152 @@ double DegreeCorrectedUndirectedBlockmodel::getLogLikelihoodIncrease(
 	if (r == s)
 		return 0.0;
 
-	double result = 0.0, degree;
-	Vector k(m_numTypes);
-
-    // Get the neighbors of the affected vertex
-    Vector neighbors = m_pGraph->neighbors(mutation.vertex);
-
 	// Calculate k, the number of edges between the vertex and other
-	// vertices of a given type
-    for (Vector::const_iterator it = neighbors.begin();
-         it != neighbors.end(); it++)
-        k[m_types[*it]]++;
-	degree = neighbors.size();
-
-	// Calculate the difference
-	for (int t = 0; t < m_numTypes; t++) {
-		double diff = 0.0;
-		if (t == r) {
-			if (k[r] > 0) {
-				diff += b(m_edgeCounts(r, r) - 2 * k[r]);
-				diff -= b(m_edgeCounts(r, r));
-			}
-			if (k[r] != k[s]) {
-				diff += b(m_edgeCounts(r, s) + k[r] - k[s]);
-				diff -= b(m_edgeCounts(r, s));
-			}
-			diff /= 2;
-		} else if (t == s) {
-			if (k[r] != k[s]) {
-				diff += b(m_edgeCounts(r, s) + k[r] - k[s]);
-				diff -= b(m_edgeCounts(r, s));
-			}
-			if (k[s] > 0) {
-				diff += b(m_edgeCounts(s, s) + 2 * k[s]);
-				diff -= b(m_edgeCounts(s, s));
-			}
-			diff /= 2;
-		} else if (k[t] > 0) {
-			diff += b(m_edgeCounts(r, t) - k[t]);
-			diff -= b(m_edgeCounts(r, t));
-			diff += b(m_edgeCounts(s, t) + k[t]);
-			diff -= b(m_edgeCounts(s, t));
-		}
-		result += diff;
+	// vertices of a given type. Only the types listed in the histogram
+	// have non-zero counts.
+	countNeighborTypes(mutation.vertex, m_histogram);
+
+	const double* k = &m_histogram.counts[0];
+	double kr = k[r], ks = k[s], degree = getDegree(mutation.vertex);
+	double result = 0.0;
+
+	// Calculate the difference. Pairs of groups not involving r or s are
+	// affected only if the vertex has neighbors in the other group.
+	std::vector<int>::const_iterator it;
+	for (it = m_histogram.types.begin(); it != m_histogram.types.end(); it++) {
+		int t = *it;
+		if (t == r || t == s)
+			continue;
+		result += b(m_edgeCounts(r, t) - k[t]) - b(m_edgeCounts(r, t));
+		result += b(m_edgeCounts(s, t) + k[t]) - b(m_edgeCounts(s, t));
 	}
 
+	// The pairs (r, r), (s, s) and (r, s). Diagonal elements contain twice
+	// the number of edges.
+	if (kr > 0)
+		result += (b(m_edgeCounts(r, r) - 2 * kr) - b(m_edgeCounts(r, r))) / 2;
+	if (ks > 0)
+		result += (b(m_edgeCounts(s, s) + 2 * ks) - b(m_edgeCounts(s, s))) / 2;
+	if (kr != ks)
+		result += b(m_edgeCounts(r, s) + kr - ks) - b(m_edgeCounts(r, s));
+
+	m_histogram.clear();
+
 	// Correction for the m_degrees * logTheta term.
 	// Affected are all the nodes in groups r and s
 	result += b(m_sumOfDegreesByType[r]) - b(m_sumOfDegreesByType[r] - degree);
 	result += b(m_sumOfDegreesByType[s]) - b(m_sumOfDegreesByType[s] + degree);
-	
+
 	return result;
 }
 
-double DegreeCorrectedUndirectedBlockmodel::recalculateLogLikelihood() const {
-    Vector logTheta = m_degrees;
+void DegreeCorrectedUndirectedBlockmodel::getLogLikelihoodIncreases(
+        long index, Vector& result, NeighborTypeHistogram& histogram) const {
+    int r = m_types[index];
+    double degree = getDegree(index);
+    double sumR = 0.0, diffR, diffS, diffRR, diffRS, diffSS;
+    std::vector<int>::const_iterator it;
+
+    result.resize(m_numTypes);
+    countNeighborTypes(index, histogram);
+
+    const double* k = &histogram.counts[0];
+    double kr = k[r];
+
+    // Changes in row r caused by the vertex leaving group r; these do not
+    // depend on the destination group. Only groups that the vertex is
+    // connected to are affected.
+    for (it = histogram.types.begin(); it != histogram.types.end(); it++) {
+        if (*it != r)
+            sumR += b(m_edgeCounts(r, *it) - k[*it]) - b(m_edgeCounts(r, *it));
+    }
+    diffRR = (kr > 0) ? b(m_edgeCounts(r, r) - 2 * kr) - b(m_edgeCounts(r, r)) : 0;
+    diffR = b(m_sumOfDegreesByType[r]) - b(m_sumOfDegreesByType[r] - degree);
 
-    for (size_t i = 0; i < logTheta.size(); i++) {
-        logTheta[i] /= m_sumOfDegreesByType[m_types[i]];
-        logTheta[i] = std::log(logTheta[i]);
+    for (int s = 0; s < m_numTypes; s++) {
+        if (s == r) {
+            result[s] = 0.0;
+            continue;
+        }
+
+        double ks = k[s];
+
+        diffS = 0.0;
+        for (it = histogram.types.begin(); it != histogram.types.end(); it++) {
+            if (*it != r && *it != s)
+                diffS += b(m_edgeCounts(s, *it) + k[*it]) - b(m_edgeCounts(s, *it));
+        }
+        diffRS = (kr != ks) ?
+            b(m_edgeCounts(r, s) + kr - ks) - b(m_edgeCounts(r, s)) : 0;
+        diffSS = (ks > 0) ? b(m_edgeCounts(s, s) + 2 * ks) - b(m_edgeCounts(s, s)) : 0;
+
+        result[s] = sumR + diffS + diffRR / 2 + diffRS + diffSS / 2 + diffR +
+            b(m_sumOfDegreesByType[s]) - b(m_sumOfDegreesByType[s] + degree);
+
+        // The loop above included the pair (r, s) in sumR if the vertex
+        // has neighbors in group s; remove it from there
+        if (ks > 0)
+            result[s] -= b(m_edgeCounts(r, s) - ks) - b(m_edgeCounts(r, s));
     }
 
-    double result = m_degrees * logTheta;
+    histogram.clear();
+}
+
+double DegreeCorrectedUndirectedBlockmodel::getLogLikelihoodTerm(
+        int type1, int type2) const {
+    long edges = m_edgeCounts(type1, type2);
+    if (edges == 0)
+        return 0.0;
+
+    double result = xlogx(edges) - edges * (
+            std::log(static_cast<double>(m_sumOfDegreesByType[type1])) +
+            std::log(static_cast<double>(m_sumOfDegreesByType[type2])));
+    return (type1 == type2) ? result / 2 : result;
+}
 
+double DegreeCorrectedUndirectedBlockmodel::getMergeLogLikelihoodIncrease(
+        int type1, int type2) const {
+    if (type1 == type2)
+        return 0.0;
+
+    double result = 0.0;
+
+    // The pairs of the merged group with the other groups. The linear parts
+    // of b() cancel out as the total number of edges does not change.
     for (int i = 0; i < m_numTypes; i++) {
-        double ec;
+        if (i == type1 || i == type2)
+            continue;
+        long edges1 = m_edgeCounts(type1, i), edges2 = m_edgeCounts(type2, i);
+        result += xlogx(edges1 + edges2) - xlogx(edges1) - xlogx(edges2);
+    }
 
-        ec = m_edgeCounts(i, i);
-        if (ec > 0) {
-            result += 0.5 * ec * (std::log(ec) - 1);
-		}
+    // The merged group with itself; the diagonal counts are doubled
+    long edges11 = m_edgeCounts(type1, type1), edges22 = m_edgeCounts(type2, type2);
+    long edges12 = m_edgeCounts(type1, type2);
+    result += (xlogx(edges11 + edges22 + 2 * edges12) - xlogx(edges11) -
+            xlogx(edges22)) / 2 - xlogx(edges12);
 
-        for (int j = i+1; j < m_numTypes; j++) {
-            ec = m_edgeCounts(i, j);
-            if (ec > 0)
-                result += ec * (std::log(ec) - 1);
-        }
+    // The m_degrees * log(theta) terms
+    long sum1 = m_sumOfDegreesByType[type1], sum2 = m_sumOfDegreesByType[type2];
+    result += xlogx(sum1) + xlogx(sum2) - xlogx(sum1 + sum2);
+
+    return result;
+}
+
+double DegreeCorrectedUndirectedBlockmodel::recalculateLogLikelihood() const {
+    double result = 0.0;
+
+    // This is the sum of m_degrees * log(theta), where theta is the degree
+    // of a vertex divided by the sum of degrees in its group
+    for (size_t i = 0; i < m_degrees.size(); i++)
+        result += xlogx(m_degrees[i]);
+    for (int i = 0; i < m_numTypes; i++)
+        result -= xlogx(m_sumOfDegreesByType[i]);
+
+    for (int i = 0; i < m_numTypes; i++) {
+        result += 0.5 * b(m_edgeCounts(i, i));
+        for (int j = i+1; j < m_numTypes; j++)
+            result += b(m_edgeCounts(i, j));
     }
 
     m_logLikelihood = result;
@@ -518,11 +1011,16 @@ double DegreeCorrectedUndirectedBlockmodel::recalculateLogLikelihood() const {
 }
 
 double DegreeCorrectedUndirectedBlockmodel::getRate(int i, int j) const {
+    if (m_pGraph == NULL)
+        return m_rates(i, j);
     return m_edgeCounts(i, j);
 }
 
 void DegreeCorrectedUndirectedBlockmodel::getRates(Matrix& result) const {
-    result = m_edgeCounts;
+    if (m_pGraph == NULL)
+        result = m_rates;
+    else
+        result = getEdgeCounts();
 }
 
 Matrix DegreeCorrectedUndirectedBlockmodel::getRates() const {
@@ -549,20 +1047,6 @@ Vector DegreeCorrectedUndirectedBlockmodel::getStickinesses() const {
     return result;
 }
 
-void DegreeCorrectedUndirectedBlockmodel::recountEdges() {
-    if (m_pGraph == NULL)
-        return;
-
-    Blockmodel::recountEdges();
-
-    long n = m_pGraph->vcount();
-
-    m_sumOfDegreesByType.fill(0);
-    for (long i = 0; i < n; i++) {
-        m_sumOfDegreesByType[m_types[i]] += m_degrees[i];
-    }
-}
-
 void DegreeCorrectedUndirectedBlockmodel::setStickinesses(
         const igraph::Vector& stickinesses) {
     if (m_pGraph != NULL)
@@ -572,17 +1056,23 @@ void DegreeCorrectedUndirectedBlockmodel::setStickinesses(
 }
 
 void DegreeCorrectedUndirectedBlockmodel::setGraph(igraph::Graph* graph) {
-    if (graph != NULL)
-        graph->degree(&m_degrees, VertexSelector::All());
-    else
+    if (graph != NULL) {
+        Vector degrees;
+        graph->degree(&degrees, VertexSelector::All());
+        m_degrees.assign(degrees.begin(), degrees.end());
+    } else {
         m_degrees.clear();
+    }
 
     Blockmodel::setGraph(graph);
 }
 
 void DegreeCorrectedUndirectedBlockmodel::setNumTypes(int numTypes) {
-    m_sumOfDegreesByType.resize(numTypes);
     Blockmodel::setNumTypes(numTypes);
+    if (m_pGraph != NULL)
+        m_rates.resize(0, 0);
+    else
+        m_rates.resize(numTypes, numTypes);
 }
 
 void DegreeCorrectedUndirectedBlockmodel::setRates(const igraph::Matrix& r) {
@@ -591,7 +1081,7 @@ void DegreeCorrectedUndirectedBlockmodel::setRates(const igraph::Matrix& r) {
     if (m_pGraph != NULL)
         throw new std::runtime_error("cannot set rate matrix when a graph is linked "
                                      "to the model");
-    m_edgeCounts = r;
+    m_rates = r;
 
     // Invalidate the log-likelihood cache
     invalidateCache();
@@ -599,15 +1089,4 @@ void DegreeCorrectedUndirectedBlockmodel::setRates(const igraph::Matrix& r) {
     recountEdges();
 }
 
-void DegreeCorrectedUndirectedBlockmodel::setType(long index, int newType) {
-    int oldType = m_types[index];
-    if (m_types[index] == newType)
-        return;
-
-    double degree = m_degrees[index];
-    m_sumOfDegreesByType[oldType] -= degree;
-    Blockmodel::setType(index, newType);
-    m_sumOfDegreesByType[newType] += degree;
-}
-
 
@@ -3,6 +3,7 @@
 #include <cmath>
 #include <limits>
 #include <sstream>
+#include <stdexcept>
 #include <block/convergence.h>
 #include <block/math.hpp>
 
@@ -53,4 +54,104 @@ void MannWhitneyConvergenceCriterion::reset() {
     m_prevSamples.clear();
 }
 
+/***************************************************************************/
+
+GelmanRubinConvergenceCriterion::GelmanRubinConvergenceCriterion(
+        int numChains, float threshold) : ConvergenceCriterion(),
+    m_numChains(numChains), m_blockLengths(), m_blockMeans(),
+    m_blockSquares(), m_threshold(threshold) {
+    if (numChains < 2)
+        throw std::invalid_argument("at least two chains are needed");
+    reset();
+}
+
+bool GelmanRubinConvergenceCriterion::check(const Vector& samples) {
+    long length = samples.size() / m_numChains;
+    double grandMean = 0.0, within = 0.0, between = 0.0;
+    Vector means(m_numChains);
+    long n = 0;
+
+    // Store the mean and the sum of squared deviations of the new block
+    // of every chain
+    m_blockLengths.push_back(length);
+    for (int i = 0; i < m_numChains; i++) {
+        Vector::const_iterator begin = samples.begin() + i * length;
+        Vector::const_iterator end = begin + length;
+        double mean = 0.0, squares = 0.0;
+
+        for (Vector::const_iterator it = begin; it != end; it++)
+            mean += *it;
+        if (length > 0)
+            mean /= length;
+        for (Vector::const_iterator it = begin; it != end; it++)
+            squares += (*it - mean) * (*it - mean);
+
+        m_blockMeans.push_back(mean);
+        m_blockSquares.push_back(squares);
+    }
+
+    // Combine the retained blocks of every chain, i.e. the second half of
+    // the blocks, with the pairwise update formula of the variance
+    size_t numBlocks = m_blockLengths.size();
+    for (int i = 0; i < m_numChains; i++) {
+        double mean = 0.0, squares = 0.0;
+        long count = 0;
+
+        for (size_t block = numBlocks / 2; block < numBlocks; block++) {
+            long blockCount = m_blockLengths[block];
+            if (blockCount == 0)
+                continue;
+
+            double delta = m_blockMeans[block * m_numChains + i] - mean;
+            squares += m_blockSquares[block * m_numChains + i] +
+                delta * delta * count * blockCount / (count + blockCount);
+            mean += delta * blockCount / (count + blockCount);
+            count += blockCount;
+        }
+
+        n = count;
+        means[i] = mean;
+        grandMean += mean;
+        if (count > 1)
+            within += squares / (count - 1);
+    }
+
+    if (n < 2) {
+        m_rHat = std::numeric_limits<double>::quiet_NaN();
+        return false;
+    }
 
+    grandMean /= m_numChains;
+    within /= m_numChains;
+
+    // This is B/n, the variance of the means of the chains
+    for (int i = 0; i < m_numChains; i++)
+        between += (means[i] - grandMean) * (means[i] - grandMean);
+    between /= (m_numChains - 1);
+
+    if (within > 0) {
+        double m = m_numChains;
+        m_rHat = std::sqrt(((n - 1.0) / n * within +
+                    (m + 1) / m * between) / within);
+    } else {
+        m_rHat = (between > 0) ? std::numeric_limits<double>::infinity() : 1.0;
+    }
+
+    return m_rHat < m_threshold;
+}
+
+std::string GelmanRubinConvergenceCriterion::report() const {
+    if (isnan(m_rHat))
+        return "no potential scale reduction factor so far";
+
+    std::ostringstream oss;
+    oss << "potential scale reduction factor: " << m_rHat;
+    return oss.str();
+}
+
+void GelmanRubinConvergenceCriterion::reset() {
+    m_blockLengths.clear();
+    m_blockMeans.clear();
+    m_blockSquares.clear();
+    m_rHat = std::numeric_limits<double>::quiet_NaN();
+}
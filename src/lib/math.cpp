@@ -2,3 +2,35 @@
 
 #include <block/math.hpp>
 
+namespace {
+    std::vector<double> xlogxTable;
+}
+
+const double* XLogXTable::m_values = 0;
+long XLogXTable::m_size = XLogXTable::initialize();
+
+void XLogXTable::fill(long size) {
+    long x = xlogxTable.size();
+
+    xlogxTable.resize(size);
+    if (x == 0)
+        xlogxTable[x++] = 0.0;
+    for (; x < size; x++)
+        xlogxTable[x] = x * std::log(static_cast<double>(x));
+
+    m_values = &xlogxTable[0];
+}
+
+long XLogXTable::initialize() {
+    fill(DEFAULT_SIZE);
+    return DEFAULT_SIZE;
+}
+
+void XLogXTable::reserve(long size) {
+    size = std::min(size, MAX_SIZE);
+    if (size <= m_size)
+        return;
+
+    fill(size);
+    m_size = size;
+}
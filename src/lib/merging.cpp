@@ -0,0 +1,38 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#include <stdexcept>
+#include <block/merging.h>
+
+GroupMerger::GroupMerger() : m_numTypes(0) {
+}
+
+void GroupMerger::initialize(const Blockmodel* pModel) {
+    m_numTypes = pModel->getNumTypes();
+}
+
+double GroupMerger::mergeCheapestPair(Blockmodel* pModel) {
+    int numTypes = pModel->getNumTypes();
+    int bestType1 = -1, bestType2 = -1;
+    double bestIncrease = 0.0;
+
+    if (numTypes != m_numTypes)
+        throw std::invalid_argument("the number of groups of the model changed");
+    if (numTypes < 2)
+        throw std::invalid_argument("the model must have at least two groups");
+
+    for (int i = 0; i < numTypes; i++) {
+        for (int j = i+1; j < numTypes; j++) {
+            double increase = pModel->getMergeLogLikelihoodIncrease(i, j);
+            if (bestType1 < 0 || increase > bestIncrease) {
+                bestIncrease = increase;
+                bestType1 = i;
+                bestType2 = j;
+            }
+        }
+    }
+
+    pModel->mergeTypes(bestType1, bestType2);
+    m_numTypes = pModel->getNumTypes();
+
+    return bestIncrease;
+}
@@ -1,6 +1,8 @@
 /* vim:set ts=4 sw=4 sts=4 et: */
 
+#include <algorithm>
 #include <cmath>
+#include <vector>
 #include <block/optimization.hpp>
 #include <igraph/cpp/graph.h>
 
@@ -16,8 +18,7 @@ namespace {
 
 template<>
 bool GreedyStrategy<UndirectedBlockmodel>::step(UndirectedBlockmodel *pModel) {
-    const Graph* graph = pModel->getGraph();
-    long int i, n = graph->vcount();
+    long int n = pModel->getGraph()->vcount();
     int k = pModel->getNumTypes();
     double logL = pModel->getLogLikelihood();
     Vector oldTypeCounts(pModel->getTypeCounts());
@@ -60,38 +61,122 @@ bool GreedyStrategy<UndirectedBlockmodel>::step(UndirectedBlockmodel *pModel) {
     // TODO: or column? Think about it. It doesn't matter for undirected
     // blockmodels, but it may matter for directed ones.
 
-    // For each vertex...
-    for (i = 0; i < n; i++) {
-        // First we calculate the number of neighbors of type k for vertex i,
-        // which we will denote with neiCountByType(k).
-        Vector neiCountByType(k);
-        Vector neis = graph->neighbors(i);
-        for (Vector::iterator it = neis.begin(); it != neis.end(); it++) {
-            neiCountByType[pModel->getType(*it)]++;
+    // In matrix notation, the scores of all the vertices form an n x k
+    // matrix S = 1 * (log(1-P) * N)^T + A * (logP - log(1-P)) - C, where A
+    // is the sparse n x k matrix of neighbor counts by type and row i of C
+    // is row t_i of log(1-P). (All the matrices are symmetric.) The first
+    // term is the same for every vertex, so it is calculated only once.
+    std::vector<double> logPMinusLog1PRows(k * k), log1PRows(k * k);
+    std::vector<double> baseScores(k);
+    for (int a = 0; a < k; a++) {
+        double score = 0.0;
+        for (int b = 0; b < k; b++) {
+            logPMinusLog1PRows[a * k + b] = logP_minus_log1P(a, b);
+            log1PRows[a * k + b] = log1P(a, b);
+            score += log1P(a, b) * oldTypeCounts[b];
         }
+        baseScores[a] = score;
+    }
 
-        // We already have logP - log1P, so all we need is two matrix-vector
-        // products and an addition.
-        neiCountByType = logP_minus_log1P * neiCountByType;
-        neiCountByType += (log1P * oldTypeCounts);
-        // We might get 'nan' values after this step in neiCountByType if
-        // an infinity or negative infinity (occurring in logP_minus_log1P
-        // or log1P) was multiplied by zero. We don't care, though, nan
-        // values will never be selected as maxima anyway.
-
-        // Now the correction mentioned above
-        neiCountByType -= log1P.getRow(pModel->getType(i));
-
-        // Find the maximum element
-        newTypes[i] = 
-            std::max_element(neiCountByType.begin(), neiCountByType.end()) -
-            neiCountByType.begin();
+    // The product A * (logP - log(1-P)) is calculated for blocks of
+    // consecutive vertices. The non-zero elements of A in a block are sorted
+    // by type, so every row of logP - log(1-P) is loaded into the cache only
+    // once per block, and the scores of the block stay in the cache until
+    // we select the row-wise maxima.
+    //
+    // The blocks are independent of each other as the new types are not
+    // applied until the end of the step, so they can be processed in
+    // parallel with thread-local scratch space.
+    const long int blockSize = 64;
+    long int numBlocks = (n + blockSize - 1) / blockSize;
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        NeighborTypeHistogram histogram;
+        std::vector<double> scores(blockSize * k);
+        std::vector<int> entryTypes, entryRows, sortedRows, typeOffsets(k + 1);
+        std::vector<double> entryCounts, sortedCounts;
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 4)
+#endif
+        for (long int block = 0; block < numBlocks; block++) {
+            long int first = block * blockSize;
+            long int last = std::min(first + blockSize, n);
+            long int numRows = last - first;
+
+            // Initialize the scores with the constant part and the
+            // correction mentioned above, and collect the non-zero neighbor
+            // counts of the block
+            entryTypes.clear(); entryRows.clear(); entryCounts.clear();
+            for (long int i = first; i < last; i++) {
+                double* row = &scores[(i - first) * k];
+                const double* correction = &log1PRows[pModel->getType(i) * k];
+                for (int a = 0; a < k; a++)
+                    row[a] = baseScores[a] - correction[a];
+
+                pModel->countNeighborTypes(i, histogram);
+                for (std::vector<int>::const_iterator it = histogram.types.begin();
+                     it != histogram.types.end(); it++) {
+                    entryTypes.push_back(*it);
+                    entryRows.push_back(i - first);
+                    entryCounts.push_back(histogram.counts[*it]);
+                }
+                histogram.clear();
+            }
+
+            // Counting sort of the entries by type
+            size_t numEntries = entryTypes.size();
+            sortedRows.resize(numEntries);
+            sortedCounts.resize(numEntries);
+            std::fill(typeOffsets.begin(), typeOffsets.end(), 0);
+            for (size_t j = 0; j < numEntries; j++)
+                typeOffsets[entryTypes[j] + 1]++;
+            for (int a = 0; a < k; a++)
+                typeOffsets[a + 1] += typeOffsets[a];
+            for (size_t j = 0; j < numEntries; j++) {
+                int pos = typeOffsets[entryTypes[j]]++;
+                sortedRows[pos] = entryRows[j];
+                sortedCounts[pos] = entryCounts[j];
+            }
+
+            // Multiply the sparse block with logP - log(1-P). After the
+            // counting sort, typeOffsets[b] is the end of the entries of
+            // type b.
+            //
+            // Note that zero neighbor counts are not stored in the block,
+            // so a pair of groups with p = 0 or p = 1 (where logP - log(1-P)
+            // is infinite) does not contribute to the scores of a vertex
+            // that has no neighbors in the other group. This matches the
+            // 0 * log(0) = 0 convention of the log-likelihood. The dense
+            // product that was used earlier multiplied the zero counts as
+            // well and got NaN from 0 * inf, after which std::max_element
+            // returned an arbitrary type. An infinity and a negative
+            // infinity may still add up to NaN if the vertex has neighbors
+            // in both groups.
+            size_t j = 0;
+            for (int b = 0; b < k; b++) {
+                const double* source = &logPMinusLog1PRows[b * k];
+                for (; j < static_cast<size_t>(typeOffsets[b]); j++) {
+                    double* row = &scores[sortedRows[j] * k];
+                    double count = sortedCounts[j];
+                    for (int a = 0; a < k; a++)
+                        row[a] += count * source[a];
+                }
+            }
+
+            // Find the maximum element in each row
+            for (long int r = 0; r < numRows; r++) {
+                double* row = &scores[r * k];
+                newTypes[first + r] = std::max_element(row, row + k) - row;
+            }
+        }
     }
 
     stepDone();
 
-    // TODO: rewrite the above to use a single matrix-matrix multiplication,
-    // maybe that's faster?
     if (newTypes != pModel->getTypes()) {
         pModel->setTypes(newTypes);
         return (pModel->getLogLikelihood() > logL);
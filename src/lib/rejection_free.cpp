@@ -0,0 +1,141 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#include <cmath>
+#include <limits>
+#include <block/optimization.hpp>
+
+RejectionFreeStrategy::RejectionFreeStrategy(double margin, long refreshPeriod)
+    : RandomizedOptimizationStrategy<Blockmodel>(), m_bounds(),
+    m_inverseTemperature(1.0), m_margin(margin), m_refreshPeriod(refreshPeriod),
+    m_numMovesSinceRefresh(0), m_numDrawsSinceMove(0), m_pLastModel(0),
+    m_lastNumTypes(0), m_equivalentStepCount(0), m_lastWaitingTime(0),
+    m_lastProposalAccepted(false), m_numMoves(0), m_numBoundViolations(0),
+    m_rates(), m_histogram() {
+}
+
+double RejectionFreeStrategy::calculateRates(const Blockmodel* pModel, long vertex) {
+    int k = pModel->getNumTypes();
+    int type = pModel->getType(vertex);
+    double total = 0.0;
+
+    m_rates.resize(k);
+    pModel->getLogLikelihoodIncreases(vertex, m_rates, m_histogram);
+    for (int j = 0; j < k; j++) {
+        double increase = m_inverseTemperature * m_rates[j];
+        m_rates[j] = (j == type) ? 0.0 :
+            ((increase >= 0) ? 1.0 : std::exp(increase)) / k;
+        total += m_rates[j];
+    }
+
+    return total;
+}
+
+void RejectionFreeStrategy::refreshVertex(const Blockmodel* pModel, long vertex) {
+    // The total rate can never exceed (k-1)/k, so neither should the bound
+    int k = pModel->getNumTypes();
+    double bound = calculateRates(pModel, vertex) * std::exp(m_margin);
+    m_bounds.set(vertex, std::min(bound, (k - 1.0) / k));
+}
+
+void RejectionFreeStrategy::refreshAll(const Blockmodel* pModel) {
+    long n = pModel->getGraph()->vcount();
+    int k = pModel->getNumTypes();
+    double factor = std::exp(m_margin);
+    std::vector<double> bounds(n);
+
+    // The old bounds of the same model were used by the draws since the
+    // last move, so the ones exceeded in the current state are counted here
+    // even if their vertices were not drawn
+    bool checkBounds = (m_pLastModel == pModel && m_lastNumTypes == k &&
+            m_bounds.size() == n && m_numDrawsSinceMove > 0);
+
+    for (long i = 0; i < n; i++) {
+        double rate = calculateRates(pModel, i);
+        if (checkBounds && rate > m_bounds.get(i))
+            m_numBoundViolations++;
+        bounds[i] = std::min(rate * factor, (k - 1.0) / k);
+    }
+    m_bounds.assign(bounds);
+
+    m_pLastModel = pModel;
+    m_lastNumTypes = k;
+    m_numMovesSinceRefresh = 0;
+}
+
+bool RejectionFreeStrategy::step(Blockmodel* pModel) {
+    long n = pModel->getGraph()->vcount();
+    long refreshPeriod = m_refreshPeriod > 0 ? m_refreshPeriod : n;
+
+    if (m_pLastModel != pModel || m_lastNumTypes != pModel->getNumTypes() ||
+            m_bounds.size() != n || m_numMovesSinceRefresh >= refreshPeriod)
+        refreshAll(pModel);
+
+    m_lastProposalAccepted = false;
+    stepDone();
+
+    // The number of Metropolis-Hastings steps until the next draw follows
+    // a geometric distribution with the total bound per vertex as the
+    // success probability
+    double p = m_bounds.total() / n;
+    if (p <= 0) {
+        // No vertex can move at all
+        m_lastWaitingTime = 1;
+        m_equivalentStepCount += 1;
+        return false;
+    }
+
+    double waitingTime = 1.0;
+    if (p < 1)
+        waitingTime += std::floor(std::log(1.0 - m_pRng->random()) / std::log1p(-p));
+    m_lastWaitingTime = static_cast<long>(std::min(waitingTime,
+                static_cast<double>(std::numeric_limits<long>::max() / 2)));
+    m_equivalentStepCount += waitingTime;
+
+    // Draw a vertex proportionally to the bounds and accept it with the
+    // ratio of its exact rate and its bound
+    long vertex = m_bounds.find(m_pRng->random() * m_bounds.total());
+    double bound = m_bounds.get(vertex);
+    double rate = calculateRates(pModel, vertex);
+    m_numDrawsSinceMove++;
+
+    if (rate > bound) {
+        // The bounds of the other vertices are likely to be out of date as
+        // well, so all of them are re-evaluated after this draw
+        m_numBoundViolations++;
+        m_numMovesSinceRefresh = refreshPeriod;
+    }
+    if (m_pRng->random() * bound >= rate) {
+        // The bound was too loose, we tighten it for the next draws
+        refreshVertex(pModel, vertex);
+        return false;
+    }
+
+    // Draw the new group proportionally to the exact rates
+    int k = pModel->getNumTypes();
+    int newType = 0;
+    double u = m_pRng->random() * rate - m_rates[0];
+    while (u >= 0 && newType < k-1) {
+        newType++;
+        u -= m_rates[newType];
+    }
+    if (newType == pModel->getType(vertex)) {
+        // Can only happen due to rounding; the rate of the current group
+        // is zero
+        refreshVertex(pModel, vertex);
+        return false;
+    }
+
+    pModel->performMutation(PointMutation(vertex, pModel->getType(vertex), newType));
+    m_lastProposalAccepted = true;
+    m_numMoves++;
+    m_numMovesSinceRefresh++;
+    m_numDrawsSinceMove = 0;
+
+    // Re-evaluate the vertex and its neighbors as their rates changed the most
+    refreshVertex(pModel, vertex);
+    const int* end = pModel->getNeighborsEnd(vertex);
+    for (const int* it = pModel->getNeighborsBegin(vertex); it != end; it++)
+        refreshVertex(pModel, *it);
+
+    return true;
+}
@@ -0,0 +1,224 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <block/optimization.hpp>
+#include <igraph/cpp/graph.h>
+
+using namespace igraph;
+
+int findWorstGroup(const Blockmodel* pModel) {
+    int result = -1;
+    double worstTerm = 0.0;
+
+    for (int i = 0; i < pModel->getNumTypes(); i++) {
+        if (pModel->getTypeCount(i) < 2)
+            continue;
+
+        double term = pModel->getLogLikelihoodTerm(i, i);
+        if (result < 0 || term < worstTerm) {
+            result = i;
+            worstTerm = term;
+        }
+    }
+
+    return result;
+}
+
+void bisectGroup(Blockmodel* pModel, int type, int newType,
+        MersenneTwister& rng, int maxSweeps) {
+    long int n = pModel->getGraph()->vcount();
+    std::vector<long int> vertices, queue;
+
+    for (long int i = 0; i < n; i++) {
+        if (pModel->getType(i) == type)
+            vertices.push_back(i);
+    }
+
+    // The new group is grown by a breadth-first search from a random vertex,
+    // restricted to the group being split, until it contains half of the
+    // vertices. This keeps densely connected parts of the group together,
+    // which a purely random initial split would not. If the search runs out
+    // of vertices, it is restarted from another random vertex.
+    long int numMoved = 0, target = vertices.size() / 2;
+    while (numMoved < target) {
+        long int seed = vertices[rng.randint(vertices.size())];
+        if (pModel->getType(seed) != type)
+            continue;
+
+        queue.clear();
+        queue.push_back(seed);
+        pModel->setType(seed, newType);
+        numMoved++;
+        for (size_t head = 0; head < queue.size() && numMoved < target; head++) {
+            const int* end = pModel->getNeighborsEnd(queue[head]);
+            for (const int* it = pModel->getNeighborsBegin(queue[head]);
+                 it != end && numMoved < target; it++) {
+                if (pModel->getType(*it) != type)
+                    continue;
+                pModel->setType(*it, newType);
+                queue.push_back(*it);
+                numMoved++;
+            }
+        }
+    }
+
+    // Greedy refinement; every vertex may only move between the two halves
+    bool changed = true;
+    for (int sweep = 0; sweep < maxSweeps && changed; sweep++) {
+        changed = false;
+        for (std::vector<long int>::const_iterator it = vertices.begin();
+             it != vertices.end(); it++) {
+            int from = pModel->getType(*it);
+            PointMutation mutation(*it, from, from == type ? newType : type);
+            if (pModel->getLogLikelihoodIncrease(mutation) > 1e-9) {
+                pModel->setType(*it, mutation.to);
+                changed = true;
+            }
+        }
+    }
+}
+
+/*************************************************************************/
+
+namespace {
+    /* Logarithm of the logistic function 1 / (1 + exp(-x)), calculated
+     * without overflow for large |x| */
+    inline double log_logistic(double x) {
+        return std::min(x, 0.0) - std::log(1.0 + std::exp(-std::fabs(x)));
+    }
+}
+
+MergeSplitStrategy::MergeSplitStrategy(double penalty, int numIntermediateScans)
+    : RandomizedOptimizationStrategy<Blockmodel>(), m_acceptanceRatio(1000),
+    m_lastProposalAccepted(false), m_penalty(penalty),
+    m_numIntermediateScans(numIntermediateScans), m_vertices(),
+    m_originalTypes() {
+}
+
+bool MergeSplitStrategy::proposeMerge(Blockmodel* pModel, int vertex1,
+        int vertex2) {
+    int type1 = pModel->getType(vertex1), type2 = pModel->getType(vertex2);
+    int numTypes = pModel->getNumTypes();
+    long int n = pModel->getGraph()->vcount();
+
+    m_vertices.clear();
+    m_originalTypes.clear();
+    for (long int i = 0; i < n; i++) {
+        int type = pModel->getType(i);
+        if ((type == type1 || type == type2) && i != vertex1 && i != vertex2) {
+            m_vertices.push_back(i);
+            m_originalTypes.push_back(type);
+        }
+    }
+
+    // Probability of the split that would restore the current state; the
+    // vertices are back in their original groups afterwards
+    double logProposal = reassignVertices(pModel, type1, type2, &m_originalTypes);
+    double logAcceptance = pModel->getMergeLogLikelihoodIncrease(type1, type2) +
+        getLogPrior(numTypes - 1) - getLogPrior(numTypes) + logProposal;
+
+    if (logAcceptance < 0 && m_pRng->random() > std::exp(logAcceptance))
+        return false;
+
+    pModel->mergeTypes(type1, type2);
+    return true;
+}
+
+bool MergeSplitStrategy::proposeSplit(Blockmodel* pModel, int vertex1,
+        int vertex2) {
+    int type = pModel->getType(vertex1), numTypes = pModel->getNumTypes();
+    long int n = pModel->getGraph()->vcount();
+    double oldLogL = pModel->getLogLikelihood();
+
+    m_vertices.clear();
+    for (long int i = 0; i < n; i++) {
+        if (pModel->getType(i) == type && i != vertex1 && i != vertex2)
+            m_vertices.push_back(i);
+    }
+
+    pModel->setNumTypes(numTypes + 1);
+    pModel->performMutation(PointMutation(vertex1, type, numTypes));
+    double logProposal = reassignVertices(pModel, numTypes, type, 0);
+    double logAcceptance = pModel->getLogLikelihood() - oldLogL +
+        getLogPrior(numTypes + 1) - getLogPrior(numTypes) - logProposal;
+
+    if (logAcceptance >= 0 || m_pRng->random() <= std::exp(logAcceptance))
+        return true;
+
+    // Rejected; move the new group back. It is the last one, so removing
+    // it does not affect the indices of the other groups
+    GroupMutation mutation(numTypes, type);
+    mutation.vertices.push_back(vertex1);
+    for (std::vector<int>::const_iterator it = m_vertices.begin();
+         it != m_vertices.end(); it++) {
+        if (pModel->getType(*it) == numTypes)
+            mutation.vertices.push_back(*it);
+    }
+    mutation.perform(*pModel);
+
+    return false;
+}
+
+double MergeSplitStrategy::reassignVertices(Blockmodel* pModel, int type1,
+        int type2, const std::vector<int>* targetTypes) {
+    size_t numVertices = m_vertices.size();
+    double result = 0.0;
+
+    // Random launch state
+    for (size_t i = 0; i < numVertices; i++) {
+        int from = pModel->getType(m_vertices[i]);
+        int to = m_pRng->randint(2) ? type1 : type2;
+        if (from != to)
+            pModel->performMutation(PointMutation(m_vertices[i], from, to));
+    }
+
+    // Restricted Gibbs sweeps; only the last one counts in the result
+    for (int scan = 0; scan <= m_numIntermediateScans; scan++) {
+        bool isFinal = (scan == m_numIntermediateScans);
+
+        for (size_t i = 0; i < numVertices; i++) {
+            int from = pModel->getType(m_vertices[i]);
+            int to = (from == type1) ? type2 : type1;
+            PointMutation mutation(m_vertices[i], from, to);
+            double diff = pModel->getLogLikelihoodIncrease(mutation);
+            double logPMove = log_logistic(diff);
+            bool move;
+
+            if (isFinal && targetTypes != 0)
+                move = ((*targetTypes)[i] == to);
+            else
+                move = (m_pRng->random() < std::exp(logPMove));
+
+            if (isFinal)
+                result += move ? logPMove : log_logistic(-diff);
+            if (move)
+                pModel->performMutation(mutation);
+        }
+    }
+
+    return result;
+}
+
+bool MergeSplitStrategy::step(Blockmodel* pModel) {
+    long int n = pModel->getGraph()->vcount();
+
+    if (n < 2)
+        return false;
+
+    int vertex1 = m_pRng->randint(n);
+    int vertex2 = m_pRng->randint(n - 1);
+    if (vertex2 >= vertex1)
+        vertex2++;
+
+    if (pModel->getType(vertex1) == pModel->getType(vertex2))
+        m_lastProposalAccepted = proposeSplit(pModel, vertex1, vertex2);
+    else
+        m_lastProposalAccepted = proposeMerge(pModel, vertex1, vertex2);
+
+    m_acceptanceRatio.push_back(m_lastProposalAccepted);
+    stepDone();
+
+    return true;
+}
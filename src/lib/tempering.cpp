@@ -0,0 +1,136 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <block/parallel.hpp>
+#include <block/tempering.h>
+
+using igraph::Vector;
+
+ParallelTempering::ParallelTempering() : m_replicas(), m_samplers(),
+    m_temperatures(), m_roundBestModels(), m_roundBestLogLs(),
+    m_pBestModel(0), m_bestLogL(-std::numeric_limits<double>::max()),
+    m_rng(), m_numSwapsProposed(), m_numSwapsAccepted(), m_numRounds(0) {
+}
+
+ParallelTempering::~ParallelTempering() {
+    clear();
+}
+
+void ParallelTempering::clear() {
+    for (size_t i = 0; i < m_replicas.size(); i++) {
+        delete m_replicas[i];
+        delete m_samplers[i];
+        delete m_roundBestModels[i];
+    }
+    delete m_pBestModel;
+
+    m_replicas.clear();
+    m_samplers.clear();
+    m_roundBestModels.clear();
+    m_pBestModel = 0;
+}
+
+double ParallelTempering::getSwapAcceptanceRate(int index) const {
+    if (m_numSwapsProposed[index] == 0)
+        return 0.0;
+    return static_cast<double>(m_numSwapsAccepted[index]) /
+        m_numSwapsProposed[index];
+}
+
+void ParallelTempering::initialize(const Blockmodel* pModel, int numReplicas,
+        double minTemperature, double maxTemperature, MersenneTwister& rng) {
+    if (numReplicas < 1)
+        throw std::invalid_argument("the number of replicas must be positive");
+    if (minTemperature <= 0 || maxTemperature < minTemperature)
+        throw std::invalid_argument("invalid temperature range");
+
+    clear();
+
+    m_temperatures.resize(numReplicas);
+    m_roundBestLogLs.resize(numReplicas);
+    m_numSwapsProposed.assign(numReplicas, 0);
+    m_numSwapsAccepted.assign(numReplicas, 0);
+    m_numRounds = 0;
+
+    for (int i = 0; i < numReplicas; i++) {
+        // Geometric ladder: the ratio of consecutive temperatures is constant
+        double temperature = minTemperature;
+        if (numReplicas > 1)
+            temperature *= std::pow(maxTemperature / minTemperature,
+                    static_cast<double>(i) / (numReplicas - 1));
+        m_temperatures[i] = temperature;
+
+        MetropolisHastingsStrategy* pSampler = new MetropolisHastingsStrategy();
+        pSampler->getRNG()->init_genrand(rng.genrand_int32());
+        pSampler->setInverseTemperature(1.0 / temperature);
+
+        m_samplers.push_back(pSampler);
+        m_replicas.push_back(pModel->clone());
+        m_roundBestModels.push_back(pModel->clone());
+    }
+    m_rng.init_genrand(rng.genrand_int32());
+
+    m_pBestModel = pModel->clone();
+    m_bestLogL = pModel->getLogLikelihood();
+}
+
+void ParallelTempering::proposeSwaps() {
+    long numReplicas = m_replicas.size();
+
+    for (long i = m_numRounds % 2; i + 1 < numReplicas; i += 2) {
+        double beta1 = m_samplers[i]->getInverseTemperature();
+        double beta2 = m_samplers[i+1]->getInverseTemperature();
+        double logL1 = m_replicas[i]->getLogLikelihood();
+        double logL2 = m_replicas[i+1]->getLogLikelihood();
+        double logAcceptance = (beta1 - beta2) * (logL2 - logL1);
+
+        m_numSwapsProposed[i]++;
+        if (logAcceptance >= 0 || m_rng.random() <= std::exp(logAcceptance)) {
+            // The samplers stay at their temperatures, only the states move
+            std::swap(m_replicas[i], m_replicas[i+1]);
+            m_numSwapsAccepted[i]++;
+        }
+    }
+}
+
+void ParallelTempering::runRound(long numSteps, Vector* coldSamples) {
+    long numReplicas = m_replicas.size();
+
+    // Each replica keeps track of its own best state during the round so
+    // the replicas do not have to synchronize on the global best model
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (long i = 0; i < numReplicas; i++) {
+        Blockmodel* pModel = m_replicas[i];
+        MetropolisHastingsStrategy* pSampler = m_samplers[i];
+        double bestLogL = m_bestLogL;
+
+        for (long step = 0; step < numSteps; step++) {
+            pSampler->step(pModel);
+
+            double logL = pModel->getLogLikelihood();
+            if (logL > bestLogL) {
+                m_roundBestModels[i]->assignFrom(pModel);
+                bestLogL = logL;
+            }
+            if (i == 0 && coldSamples != 0)
+                coldSamples->push_back(logL);
+        }
+
+        m_roundBestLogLs[i] = bestLogL;
+    }
+
+    for (long i = 0; i < numReplicas; i++) {
+        if (m_roundBestLogLs[i] > m_bestLogL) {
+            m_pBestModel->assignFrom(m_roundBestModels[i]);
+            m_bestLogL = m_roundBestLogLs[i];
+        }
+    }
+
+    proposeSwaps();
+    m_numRounds++;
+}
@@ -1,5 +1,6 @@
 /* vim:set ts=4 sw=4 sts=4 et: */
 
+#include <cstdlib>
 #include <ctime>
 #include <iostream>
 #include <string>
@@ -12,13 +13,26 @@ using namespace SimpleOpt;
 
 enum {
     NUM_GROUPS, NUM_SAMPLES, OUT_FORMAT,
-    LOG_PERIOD, INIT_METHOD, BLOCK_SIZE
+    LOG_PERIOD, INIT_METHOD, BLOCK_SIZE, NEIGHBOR_TYPE_CACHE,
+    REPLICAS, MIN_TEMPERATURE, MAX_TEMPERATURE, SWAP_PERIOD, CHAINS,
+    JOBS, WARM_START, K_SEARCH, K_SEARCH_BUDGET, CRITERION, MERGE_SPLIT_PERIOD,
+    PROPOSAL, SAMPLER, REJECTION_FREE_MARGIN, REJECTION_FREE_REFRESH, SWEEPS, MODE, COOLING, ANNEALING_STEPS,
+    INITIAL_TEMPERATURE, FINAL_TEMPERATURE, MAX_BLOCKS
 };
 
 CommandLineArguments::CommandLineArguments() :
     CommandLineArgumentsBase("block-fit", BLOCKMODEL_VERSION_STRING),
     numGroups(-1), numSamples(100000), outputFormat(FORMAT_PLAIN),
-    blockSize(65536), initMethod(GREEDY), logPeriod(8192) {
+    blockSize(65536), initMethod(GREEDY), logPeriod(8192),
+    useNeighborTypeCache(false), numChains(1), maxNumBlocks(100), numJobs(0),
+    warmStart(false), kSearchMethod(FULL_SEARCH), kSearchBudget(8192),
+    criterion(AIC), mergeSplitPeriod(100),
+    proposal(UNIFORM_PROPOSAL), sampler(METROPOLIS_SAMPLER),
+    rejectionFreeMargin(1.0), rejectionFreeRefreshPeriod(0), mode(SAMPLING_MODE),
+    coolingSchedule(GEOMETRIC_COOLING), annealingSteps(1000000),
+    initialTemperature(10.0), finalTemperature(0.01), useSweeps(false),
+    numReplicas(1), minTemperature(1.0), maxTemperature(10.0),
+    swapPeriod(1000) {
 
     /* basic options */
 
@@ -27,9 +41,32 @@ CommandLineArguments::CommandLineArguments() :
     addOption(NUM_SAMPLES, "-s", SO_REQ_SEP, "--samples");
 
     /* advanced options */
+    addOption(ANNEALING_STEPS, "--anneal-steps", SO_REQ_SEP);
     addOption(BLOCK_SIZE,  "--block-size",  SO_REQ_SEP);
+    addOption(CHAINS,      "--chains",      SO_REQ_SEP);
+    addOption(COOLING,     "--cooling",     SO_REQ_SEP);
+    addOption(CRITERION,   "--criterion",   SO_REQ_SEP);
+    addOption(FINAL_TEMPERATURE, "--final-temperature", SO_REQ_SEP);
     addOption(INIT_METHOD, "--init-method", SO_REQ_SEP);
+    addOption(INITIAL_TEMPERATURE, "--initial-temperature", SO_REQ_SEP);
+    addOption(JOBS,        "-j", SO_REQ_SEP, "--jobs");
+    addOption(K_SEARCH,    "--k-search",    SO_REQ_SEP);
+    addOption(K_SEARCH_BUDGET, "--k-search-budget", SO_REQ_SEP);
     addOption(LOG_PERIOD,  "--log-period",  SO_REQ_SEP);
+    addOption(MAX_BLOCKS,  "--max-blocks",  SO_REQ_SEP);
+    addOption(MAX_TEMPERATURE, "--max-temperature", SO_REQ_SEP);
+    addOption(MERGE_SPLIT_PERIOD, "--merge-split-period", SO_REQ_SEP);
+    addOption(MIN_TEMPERATURE, "--min-temperature", SO_REQ_SEP);
+    addOption(MODE,        "--mode",        SO_REQ_SEP);
+    addOption(NEIGHBOR_TYPE_CACHE, "--neighbor-type-cache", SO_NONE);
+    addOption(PROPOSAL,        "--proposal",        SO_REQ_SEP);
+    addOption(REJECTION_FREE_MARGIN, "--rejection-free-margin", SO_REQ_SEP);
+    addOption(REJECTION_FREE_REFRESH, "--rejection-free-refresh", SO_REQ_SEP);
+    addOption(REPLICAS,        "--replicas",        SO_REQ_SEP);
+    addOption(SAMPLER,         "--sampler",         SO_REQ_SEP);
+    addOption(SWAP_PERIOD,     "--swap-period",     SO_REQ_SEP);
+    addOption(SWEEPS,          "--sweeps",          SO_NONE);
+    addOption(WARM_START,      "--warm-start",      SO_NONE);
 }
 
 int CommandLineArguments::handleOption(int id, const std::string& arg) {
@@ -59,25 +96,227 @@ int CommandLineArguments::handleOption(int id, const std::string& arg) {
 
         /* Processing advanced parameters */
 
+        case ANNEALING_STEPS:
+            annealingSteps = atol(arg.c_str());
+            if (annealingSteps < 0) {
+                cerr << "The number of annealing steps must not be negative\n";
+                return 1;
+            }
+            break;
+
         case BLOCK_SIZE:
             blockSize = atoi(arg.c_str());
             break;
 
+        case CHAINS:
+            numChains = atoi(arg.c_str());
+            if (numChains < 1) {
+                cerr << "The number of chains must be positive\n";
+                return 1;
+            }
+            break;
+
+        case COOLING:
+            if (arg == "geometric")
+                coolingSchedule = GEOMETRIC_COOLING;
+            else if (arg == "linear")
+                coolingSchedule = LINEAR_COOLING;
+            else if (arg == "adaptive")
+                coolingSchedule = ADAPTIVE_COOLING;
+            else {
+                cerr << "Unknown cooling schedule: " << arg << '\n';
+                return 1;
+            }
+            break;
+
+        case CRITERION:
+            if (arg == "aic")
+                criterion = AIC;
+            else if (arg == "bic")
+                criterion = BIC;
+            else {
+                cerr << "Unknown information criterion: " << arg << '\n';
+                return 1;
+            }
+            break;
+
+        case FINAL_TEMPERATURE:
+            finalTemperature = atof(arg.c_str());
+            if (finalTemperature <= 0) {
+                cerr << "The final temperature must be positive\n";
+                return 1;
+            }
+            break;
+
+        case INITIAL_TEMPERATURE:
+            initialTemperature = atof(arg.c_str());
+            if (initialTemperature <= 0) {
+                cerr << "The initial temperature must be positive\n";
+                return 1;
+            }
+            break;
+
         case INIT_METHOD:
             if (arg == "greedy")
                 initMethod = GREEDY;
             else if (arg == "random")
                 initMethod = RANDOM;
+            else if (arg == "worklist")
+                initMethod = WORKLIST_GREEDY;
+            else if (arg == "kl")
+                initMethod = KERNIGHAN_LIN;
             else {
                 cerr << "Unknown initialization method: " << arg << '\n';
                 return 1;
             }
             break;
 
+        case JOBS:
+            numJobs = atoi(arg.c_str());
+            if (numJobs < 0) {
+                cerr << "The number of jobs must not be negative\n";
+                return 1;
+            }
+            break;
+
+        case K_SEARCH:
+            if (arg == "full")
+                kSearchMethod = FULL_SEARCH;
+            else if (arg == "halving")
+                kSearchMethod = SUCCESSIVE_HALVING;
+            else if (arg == "agglomerative")
+                kSearchMethod = AGGLOMERATIVE_MERGING;
+            else if (arg == "merge-split")
+                kSearchMethod = MERGE_SPLIT;
+            else {
+                cerr << "Unknown group count search method: " << arg << '\n';
+                return 1;
+            }
+            break;
+
+        case K_SEARCH_BUDGET:
+            kSearchBudget = atol(arg.c_str());
+            if (kSearchBudget < 1) {
+                cerr << "The group count search budget must be positive\n";
+                return 1;
+            }
+            break;
+
         case LOG_PERIOD:
             logPeriod = atoi(arg.c_str());
             break;
 
+        case MAX_BLOCKS:
+            maxNumBlocks = atoi(arg.c_str());
+            if (maxNumBlocks < 1) {
+                cerr << "The maximum number of blocks must be positive\n";
+                return 1;
+            }
+            break;
+
+        case MERGE_SPLIT_PERIOD:
+            mergeSplitPeriod = atol(arg.c_str());
+            if (mergeSplitPeriod < 1) {
+                cerr << "The merge-split period must be positive\n";
+                return 1;
+            }
+            break;
+
+        case MODE:
+            if (arg == "sample")
+                mode = SAMPLING_MODE;
+            else if (arg == "anneal")
+                mode = ANNEALING_MODE;
+            else {
+                cerr << "Unknown optimization mode: " << arg << '\n';
+                return 1;
+            }
+            break;
+
+        case NEIGHBOR_TYPE_CACHE:
+            useNeighborTypeCache = true;
+            break;
+
+        case WARM_START:
+            warmStart = true;
+            break;
+
+        case SWEEPS:
+            useSweeps = true;
+            break;
+
+        case PROPOSAL:
+            if (arg == "uniform")
+                proposal = UNIFORM_PROPOSAL;
+            else if (arg == "neighbor")
+                proposal = NEIGHBOR_PROPOSAL;
+            else {
+                cerr << "Unknown proposal distribution: " << arg << '\n';
+                return 1;
+            }
+            break;
+
+        case SAMPLER:
+            if (arg == "metropolis")
+                sampler = METROPOLIS_SAMPLER;
+            else if (arg == "rejection-free")
+                sampler = REJECTION_FREE_SAMPLER;
+            else if (arg == "gibbs")
+                sampler = GIBBS_SAMPLER;
+            else {
+                cerr << "Unknown sampler: " << arg << '\n';
+                return 1;
+            }
+            break;
+
+        case REJECTION_FREE_MARGIN:
+            rejectionFreeMargin = atof(arg.c_str());
+            if (rejectionFreeMargin < 0) {
+                cerr << "The margin of the rejection-free sampler must not be negative\n";
+                return 1;
+            }
+            break;
+
+        case REJECTION_FREE_REFRESH:
+            rejectionFreeRefreshPeriod = atol(arg.c_str());
+            if (rejectionFreeRefreshPeriod < 0) {
+                cerr << "The refresh period of the rejection-free sampler must not be negative\n";
+                return 1;
+            }
+            break;
+
+        case REPLICAS:
+            numReplicas = atoi(arg.c_str());
+            if (numReplicas < 1) {
+                cerr << "The number of replicas must be positive\n";
+                return 1;
+            }
+            break;
+
+        case MIN_TEMPERATURE:
+            minTemperature = atof(arg.c_str());
+            if (minTemperature <= 0) {
+                cerr << "The minimum temperature must be positive\n";
+                return 1;
+            }
+            break;
+
+        case MAX_TEMPERATURE:
+            maxTemperature = atof(arg.c_str());
+            if (maxTemperature <= 0) {
+                cerr << "The maximum temperature must be positive\n";
+                return 1;
+            }
+            break;
+
+        case SWAP_PERIOD:
+            swapPeriod = atol(arg.c_str());
+            if (swapPeriod < 1) {
+                cerr << "The swap period must be positive\n";
+                return 1;
+            }
+            break;
+
     }
 
     return 0;
@@ -97,21 +336,106 @@ void CommandLineArguments::showHelp(ostream& os) const {
           "                        will be written. The default is the standard\n"
           "                        output stream.\n"
           "    -s N, --samples N   sets the number of samples to be taken from the\n"
-          "                        Markov chain after convergence. The default is 100000.\n"
+          "                        Markov chain after convergence. Multiple chains\n"
+          "                        and parallel tempering replicas take N samples\n"
+          "                        each. The default is 100000.\n"
           "\n"
           "Advanced algorithm parameters:\n"
+          "    --anneal-steps N    sets the number of simulated annealing steps\n"
+          "                        before the final quench. The default is 1000000.\n"
           "    --block-size N      sets the block size used when determining the\n"
           "                        convergence of the Markov chain to N. The default is\n"
           "                        10000 samples.\n"
+          "    --chains N          runs N independent Markov chains in parallel and\n"
+          "                        uses the Gelman-Rubin diagnostic to decide their\n"
+          "                        convergence (see --max-blocks). The default is 1.\n"
+          "    --cooling SCHEDULE  use the given cooling schedule in simulated\n"
+          "                        annealing. Available schedules: geometric\n"
+          "                        (default), linear, adaptive.\n"
+          "    --criterion CRIT    use the given information criterion to compare the\n"
+          "                        group counts. Available criteria: aic (default),\n"
+          "                        bic.\n"
+          "    --final-temperature T\n"
+          "                        sets the temperature at the end of simulated\n"
+          "                        annealing. The default is 0.01.\n"
           "    --init-method METH  use the given initialization method METH for\n"
           "                        the Markov chain. Available methods: greedy (default),\n"
-          "                        random.\n"
+          "                        kl, random, worklist.\n"
+          "    --initial-temperature T\n"
+          "                        sets the temperature at the start of simulated\n"
+          "                        annealing. The default is 10.\n"
+          "    -j N, --jobs N      fits N group counts concurrently when the number\n"
+          "                        of groups is detected automatically. The default\n"
+          "                        is 0, which uses one job per core.\n"
+          "    --k-search METHOD   use the given method to search for the number of\n"
+          "                        groups. Available methods: full (default), which\n"
+          "                        fits every group count until convergence,\n"
+          "                        halving, which gives every group count a small\n"
+          "                        budget and keeps the better half in every round,\n"
+          "                        agglomerative, which fits the largest group\n"
+          "                        count only and merges its groups one by one,\n"
+          "                        and merge-split, which samples the number of\n"
+          "                        groups with a single Metropolis-Hastings chain.\n"
+          "    --k-search-budget N sets the number of steps given to every group\n"
+          "                        count in the first round of halving (doubled in\n"
+          "                        every round) or after every agglomerative merge.\n"
+          "                        The default is 8192.\n"
           "    --log-period COUNT  shows a status message after every COUNT steps.\n"
           "                        The default value is 8192.\n"
+          "    --max-blocks N      gives up after N blocks if multiple chains do not\n"
+          "                        converge. The default is 100.\n"
+          "    --max-temperature T\n"
+          "                        sets the temperature of the hottest replica to T.\n"
+          "                        The default is 10.\n"
+          "    --merge-split-period N\n"
+          "                        proposes a merge or a split after every N steps\n"
+          "                        of the chain with --k-search merge-split. The\n"
+          "                        default is 100.\n"
+          "    --min-temperature T\n"
+          "                        sets the temperature of the coldest replica to T.\n"
+          "                        The default is 1.\n"
+          "    --mode MODE         selects what to do with the model. Available modes:\n"
+          "                        sample (default), which samples the model until\n"
+          "                        convergence, and anneal, which finds the best\n"
+          "                        model by simulated annealing.\n"
           "    --model MODEL       selects the type of the model being fitted.\n"
           "                        Available models: uncorrected (default), degree.\n"
+          "    --neighbor-type-cache\n"
+          "                        keeps a histogram of the neighbor types for every\n"
+          "                        vertex. This makes the likelihood calculations\n"
+          "                        faster for high-degree vertices at the expense of\n"
+          "                        more memory.\n"
+          "    --proposal DIST     use the given proposal distribution for the new\n"
+          "                        groups of the vertices. Available distributions:\n"
+          "                        uniform (default), neighbor, which proposes the\n"
+          "                        groups connected to a random neighbor.\n"
+          "    --rejection-free-margin X\n"
+          "                        sets the logarithm of the factor between the bounds\n"
+          "                        of the rejection-free sampler and the move rates.\n"
+          "                        The default is 1.\n"
+          "    --rejection-free-refresh N\n"
+          "                        re-evaluates all the bounds of the rejection-free\n"
+          "                        sampler after every N moves. The sampler is exact\n"
+          "                        with N = 1 only. The default is 0, which uses the\n"
+          "                        number of vertices.\n"
+          "    --replicas N        runs N replicas of the Markov chain with parallel\n"
+          "                        tempering. The default is 1 (no tempering).\n"
+          "    --sampler SAMPLER   use the given sampler for the Markov chain.\n"
+          "                        Available samplers: metropolis (default),\n"
+          "                        rejection-free, which draws the next accepted\n"
+          "                        move directly from approximate bounds of the\n"
+          "                        move rates, and gibbs, which draws the new\n"
+          "                        group from its conditional distribution.\n"
           "    --seed SEED         use the given number to seed the random number\n"
           "                        generator.\n"
+          "    --swap-period N     proposes swaps between the replicas after every N\n"
+          "                        steps. The default is 1000.\n"
+          "    --sweeps            updates every vertex once per sweep, in shuffled\n"
+          "                        blocks of consecutive vertices, instead of\n"
+          "                        picking a random vertex in every step.\n"
+          "    --warm-start        when the number of groups is detected automatically,\n"
+          "                        starts every group count from the best model of the\n"
+          "                        previous one with its worst group split in two.\n"
     ;
 }
 
@@ -4,13 +4,34 @@
 #define _CMD_ARGUMENTS_H
 
 #include <block/io.hpp>
+#include <block/optimization.hpp>
 #include "../common/cmd_arguments_base.h"
 
 /// Possible initialization methods for the algorithm
 typedef enum {
-    GREEDY, RANDOM
+    GREEDY, RANDOM, WORKLIST_GREEDY, KERNIGHAN_LIN
 } InitializationMethod;
 
+/// Possible strategies to search for the best number of groups
+typedef enum {
+    FULL_SEARCH, SUCCESSIVE_HALVING, AGGLOMERATIVE_MERGING, MERGE_SPLIT
+} GroupCountSearchMethod;
+
+/// Possible samplers used to run the Markov chain
+typedef enum {
+    METROPOLIS_SAMPLER, REJECTION_FREE_SAMPLER, GIBBS_SAMPLER
+} SamplerType;
+
+/// Possible modes of optimization
+typedef enum {
+    SAMPLING_MODE, ANNEALING_MODE
+} OptimizationMode;
+
+/// Possible information criteria used to compare group counts
+typedef enum {
+    AIC, BIC
+} InformationCriterion;
+
 /// Command line parser for block-fit
 class CommandLineArguments : public CommandLineArgumentsBase {
 public:
@@ -40,6 +61,75 @@ public:
     /// Number of steps after which a status message is printed
     int logPeriod;
 
+    /// Whether the models should maintain per-vertex neighbor type histograms
+    bool useNeighborTypeCache;
+
+    /// Number of independent Markov chains run in parallel
+    int numChains;
+
+    /// Number of blocks after which multiple chains give up on convergence
+    int maxNumBlocks;
+
+    /// Number of group counts fitted concurrently; zero means one per core
+    int numJobs;
+
+    /// Whether each group count should start from the previous one with a group split
+    bool warmStart;
+
+    /// Strategy used to search for the best number of groups
+    GroupCountSearchMethod kSearchMethod;
+
+    /// Number of steps in the first round of successive halving or after every merge
+    long kSearchBudget;
+
+    /// Information criterion used to compare the group counts
+    InformationCriterion criterion;
+
+    /// Number of Markov chain steps between merge-split proposals
+    long mergeSplitPeriod;
+
+    /// Proposal distribution of the Metropolis-Hastings sampler
+    ProposalDistribution proposal;
+
+    /// Sampler used to run the Markov chain
+    SamplerType sampler;
+
+    /// Logarithm of the factor between the bounds and the rates of the rejection-free sampler
+    double rejectionFreeMargin;
+
+    /// Number of moves between the full re-evaluations of the rejection-free sampler; zero means n
+    long rejectionFreeRefreshPeriod;
+
+    /// Whether the model is sampled or optimized by simulated annealing
+    OptimizationMode mode;
+
+    /// Cooling schedule of simulated annealing
+    CoolingSchedule coolingSchedule;
+
+    /// Number of simulated annealing steps before the final quench
+    long annealingSteps;
+
+    /// Temperature at the start of simulated annealing
+    double initialTemperature;
+
+    /// Temperature at the end of simulated annealing
+    double finalTemperature;
+
+    /// Whether the Markov chain should visit the vertices in sweeps
+    bool useSweeps;
+
+    /// Number of replicas used in parallel tempering; 1 disables tempering
+    int numReplicas;
+
+    /// Temperature of the coldest replica in parallel tempering
+    double minTemperature;
+
+    /// Temperature of the hottest replica in parallel tempering
+    double maxTemperature;
+
+    /// Number of steps between swap proposals in parallel tempering
+    long swapPeriod;
+
 	/// Constructor
 	CommandLineArguments();
 
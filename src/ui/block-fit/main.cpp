@@ -1,15 +1,22 @@
 /* vim:set ts=4 sw=4 sts=4 et: */
 
+#include <algorithm>
 #include <csignal>
 #include <iomanip>
 #include <iostream>
 #include <limits>
 #include <memory>
 #include <sstream>
+#include <utility>
+#include <vector>
 #include <block/blockmodel.h>
 #include <block/convergence.h>
 #include <block/io.hpp>
+#include <block/math.hpp>
+#include <block/merging.h>
 #include <block/optimization.hpp>
+#include <block/parallel.hpp>
+#include <block/tempering.h>
 #include <block/util.hpp>
 #include <igraph/cpp/graph.h>
 
@@ -20,13 +27,42 @@
 using namespace igraph;
 using namespace std;
 
-class BlockmodelFittingApp {
+/// State of one of the independent Markov chains of a fitter
+struct IndependentChain {
+    /// The model of the chain
+    std::auto_ptr<Blockmodel> pModel;
+
+    /// The best model found by the chain so far
+    std::auto_ptr<Blockmodel> pBestModel;
+
+    /// The log-likelihood of the best model found by the chain so far
+    double bestLogL;
+
+    /// The sampler of the chain
+    MetropolisHastingsStrategy sampler;
+
+    /// The log-likelihoods sampled in the last block of the chain
+    Vector samples;
+
+    /// Constructor
+    IndependentChain() : pModel(0), pBestModel(0), bestLogL(0.0),
+        sampler(), samples() {}
+};
+
+/// Fits blockmodels with a given number of groups to a graph
+/**
+ * The fitter owns the model being fitted, the best model found so far and
+ * the random number generator of the process, so several fitters can run
+ * concurrently on the same graph. The models are cloned from a prototype
+ * model of the graph, so all of them share its adjacency lists.
+ */
+class BlockmodelFitter {
 private:
     /// Parsed command line arguments
     CommandLineArguments m_args;
 
-    /// Graph being analyzed by the UI
-    std::auto_ptr<Graph> m_pGraph;
+    /// Prototype of the models with a single group
+    const Blockmodel* m_pPrototype;
 
     /// Blockmodel being fitted to the graph
     std::auto_ptr<Blockmodel> m_pModel;
@@ -34,17 +70,40 @@ private:
     /// Markov chain Monte Carlo strategy to optimize the model
     MetropolisHastingsStrategy m_mcmc;
 
+    /// Rejection-free strategy used instead of \c m_mcmc if requested
+    RejectionFreeStrategy m_rejectionFree;
+
+    /// Gibbs sampler used instead of \c m_mcmc if requested
+    GibbsSamplingStrategy m_gibbs;
+
     /// Best log-likelihood found so far
     double m_bestLogL;
 
     /// Best model found so far
 	std::auto_ptr<Blockmodel> m_pBestModel;
 
+    /// Independent Markov chains if multiple chains were requested
+    /**
+     * The chains are kept after convergence, so the sampling phase
+     * continues all of them instead of a single chain.
+     */
+    std::vector<IndependentChain*> m_chains;
+
+    /// Parallel tempering sampler if multiple replicas were requested
+    /**
+     * Like \c m_chains, it is kept after convergence for the sampling
+     * phase. It may be null.
+     */
+    std::auto_ptr<ParallelTempering> m_pTempering;
+
+    /// Number of sweeps done by the Markov chain so far
+    long m_numSweeps;
+
     /// Flag to note whether we have to dump the best state when possible
     bool m_dumpBestStateFlag;
 
-    /// Writer object that is used to dump the best state
-    std::auto_ptr<Writer<Blockmodel> > m_pModelWriter;
+    /// Writer object that is used to dump the best state; may be null
+    Writer<Blockmodel>* m_pModelWriter;
 
 public:
     LOGGING_FUNCTION(debug, 2);
@@ -52,38 +111,55 @@ public:
     LOGGING_FUNCTION(error, 0);
 
     /// Constructor
-    BlockmodelFittingApp() : m_pGraph(0), m_pModel(0),
+    /**
+     * \param  args          the command line arguments
+     * \param  pPrototype    model of the graph with a single group that
+     *                       the fitted models are cloned from
+     * \param  pModelWriter  writer used to dump the best state; may be null
+     * \param  seed          the seed of the random number generator
+     */
+    BlockmodelFitter(const CommandLineArguments& args,
+            const Blockmodel* pPrototype, Writer<Blockmodel>* pModelWriter,
+            unsigned long seed)
+        : m_args(args), m_pPrototype(pPrototype), m_pModel(0),
+        m_rejectionFree(args.rejectionFreeMargin,
+                args.rejectionFreeRefreshPeriod),
         m_bestLogL(-std::numeric_limits<double>::max()),
-        m_pBestModel(0), m_dumpBestStateFlag(false),
-        m_pModelWriter(0) {}
-
-	/// Constructs a new model
-	std::auto_ptr<Blockmodel> constructNewModel(Graph* pGraph=0, int numTypes=0) {
-		std::auto_ptr<Blockmodel> result;
-
-		switch (m_args.modelType) {
-			case UNDIRECTED_BLOCKMODEL:
-				result.reset(new UndirectedBlockmodel());
-				break;
+        m_pBestModel(0), m_chains(), m_pTempering(0), m_numSweeps(0),
+        m_dumpBestStateFlag(false), m_pModelWriter(pModelWriter) {
+        m_mcmc.getRNG()->init_genrand(seed);
+        setUpSampler(&m_mcmc);
+        if (m_args.sampler == REJECTION_FREE_SAMPLER)
+            m_rejectionFree.getRNG()->init_genrand(m_mcmc.getRNG()->genrand_int32());
+        else if (m_args.sampler == GIBBS_SAMPLER)
+            m_gibbs.getRNG()->init_genrand(m_mcmc.getRNG()->genrand_int32());
+    }
 
-			case DEGREE_CORRECTED_UNDIRECTED_BLOCKMODEL:
-				result.reset(new DegreeCorrectedUndirectedBlockmodel());
-				break;
+    /// Destructor
+    ~BlockmodelFitter() {
+        discardParallelSamplers();
+    }
 
-			default:
-				throw std::runtime_error("invalid model type given");
-		}
+    /// Configures a Metropolis-Hastings sampler according to the arguments
+    void setUpSampler(MetropolisHastingsStrategy* pSampler) const {
+        pSampler->setProposalDistribution(m_args.proposal);
+    }
 
-		result->setGraph(pGraph);
+	/// Constructs a new model with all the vertices in the first group
+	/**
+	 * The model is a clone of the prototype, so nothing is calculated from
+	 * the graph and this may be called from any number of threads.
+	 */
+	std::auto_ptr<Blockmodel> constructNewModel(int numTypes) {
+		std::auto_ptr<Blockmodel> result(m_pPrototype->clone());
 		result->setNumTypes(numTypes);
-
 		return result;
 	}
 
     /// Dumps the best state found so far and clears the dump flag
     void dumpBestState() {
         info(">> dumping best state of the chain");
-        if (m_pModelWriter.get()) {
+        if (m_pModelWriter) {
             m_pModelWriter->write(m_pBestModel.get(), cout);
         } else {
             debug(">> no model writer set up, printing nothing");
@@ -93,43 +169,346 @@ public:
 
     /// Fits the blockmodel to the data using a given group count
     void fitForGivenGroupCount(int groupCount) {
+        initializeForGivenGroupCount(groupCount);
+        if (groupCount < 2)
+            return;
+
+        runUntilConvergence();
+    }
+
+    /// Sets up an initialized model with a given group count without sampling
+    void initializeForGivenGroupCount(int groupCount) {
+		m_pModel = constructNewModel(groupCount);
+        m_rejectionFree.reset();
+        discardParallelSamplers();
+
+        if (groupCount >= 2)
+            initializeModel(m_pModel.get(), *m_mcmc.getRNG());
+
+        // The clone shares the adjacency lists of the model
+        m_pBestModel.reset(m_pModel->clone());
+        m_bestLogL = m_pModel->getLogLikelihood();
+    }
+
+    /// Fits the blockmodel by splitting a group of a model with one group less
+    /**
+     * The starting state is a copy of the given model where the group with
+     * the worst internal log-likelihood term is split in two by a greedy
+     * bisection. The copy shares the adjacency lists of the given model and
+     * copies its degrees and counts, so nothing has to be recalculated from
+     * the graph.
+     */
+    void fitBySplittingGroup(const Blockmodel* pModel) {
+        int numTypes = pModel->getNumTypes() + 1;
+        int type = findWorstGroup(pModel);
+
+        m_pModel.reset(pModel->clone());
+        m_pModel->setNumTypes(numTypes);
+        if (type >= 0) {
+            debug(">> splitting group %d", type);
+            bisectGroup(m_pModel.get(), type, numTypes - 1, *m_mcmc.getRNG());
+        }
+        m_pBestModel.reset(m_pModel->clone());
+        m_rejectionFree.reset();
+        discardParallelSamplers();
+
+        runUntilConvergence();
+    }
+
+    /// Runs the selected sampling method from the current model until convergence
+    void runUntilConvergence() {
+        m_pBestModel->assignFrom(m_pModel);
+        m_bestLogL = m_pModel->getLogLikelihood();
+
+        continueUntilConvergence();
+    }
+
+    /// Continues the selected sampling method until convergence
+    /**
+     * Unlike \ref runUntilConvergence, the best model found so far is kept
+     * unless the sampling finds a better one.
+     */
+    void continueUntilConvergence() {
         bool converged = false;
         Vector samples(m_args.blockSize);
 
-		m_pModel = constructNewModel(m_pGraph.get(), groupCount);
-		m_pBestModel = constructNewModel(m_pGraph.get(), groupCount);
+        if (m_args.numChains > 1) {
+            runMultipleChains();
+            return;
+        }
+
+        if (m_args.numReplicas > 1) {
+            runParallelTempering();
+            return;
+        }
 
-        if (groupCount < 2) {
-            m_pBestModel->assignFrom(m_pModel);
+        if (m_args.mode == ANNEALING_MODE) {
+            runAnnealing();
             return;
         }
 
-        m_pModel->randomize(*m_mcmc.getRNG());
+        info(">> starting Markov chain");
+
+        // Run the Markov chain until convergence
+		std::auto_ptr<ConvergenceCriterion> pConvCrit(new EntropyConvergenceCriterion());
+        while (!converged) {
+            runBlock(m_args.blockSize, samples);
+			converged = pConvCrit->check(samples);
+
+			std::string report = pConvCrit->report();
+			if (report.size() > 0)
+				debug(">> %s", report.c_str());
+        }
+    }
+
+    /// Optimizes the current model by simulated annealing
+    /**
+     * The annealing schedule is followed by a zero-temperature quench, and
+     * the best model found along the way is kept.
+     */
+    void runAnnealing() {
+        SimulatedAnnealingStrategy annealing(m_args.coolingSchedule,
+                m_args.initialTemperature, m_args.finalTemperature,
+                m_args.annealingSteps);
+		Blockmodel* pModel = m_pModel.get();
+        double logL;
+
+        annealing.getRNG()->init_genrand(m_mcmc.getRNG()->genrand_int32());
+
+        info(">> starting simulated annealing");
+        while (annealing.step(pModel)) {
+            logL = pModel->getLogLikelihood();
+            if (m_bestLogL < logL) {
+                m_pBestModel->assignFrom(m_pModel);
+                m_bestLogL = logL;
+            }
+
+            if (annealing.getStepCount() % m_args.logPeriod == 0 && !isQuiet()) {
+                clog << '[' << setw(6) << annealing.getStepCount() << "] "
+                     << '(' << setw(2) << pModel->getNumTypes() << ") "
+                     << setw(12) << logL << "\t(" << m_bestLogL << ")\t"
+                     << (annealing.wasLastProposalAccepted() ? '*' : ' ')
+                     << setw(8) << annealing.getAcceptanceRatio() << ' '
+                     << "T = " << annealing.getTemperature()
+                     << '\n';
+            }
+
+            if (m_dumpBestStateFlag)
+                dumpBestState();
+        }
+
+        logL = pModel->getLogLikelihood();
+        info(">> log-likelihood after the quench: %.4f", logL);
+        if (m_bestLogL < logL) {
+            m_pBestModel->assignFrom(m_pModel);
+            m_bestLogL = logL;
+        }
+    }
+
+    /// Randomizes a model and runs the selected initialization method on it
+    void initializeModel(Blockmodel* pModel, MersenneTwister& rng) {
+        pModel->randomize(rng);
 
         if (m_args.initMethod == GREEDY) {
-            Blockmodel* pModel = m_pModel.get();
             if (!greedyOptimization<UndirectedBlockmodel>(pModel) &&
                 !greedyOptimization<DegreeCorrectedUndirectedBlockmodel>(pModel)) {
 				error(">> greedy initialization not available for this model, "
 					  "using random instead");
 			}
+        } else if (m_args.initMethod == WORKLIST_GREEDY) {
+            worklistGreedyOptimization(pModel);
+        } else if (m_args.initMethod == KERNIGHAN_LIN) {
+            kernighanLinOptimization(pModel);
         }
+    }
 
-        m_pBestModel->assignFrom(m_pModel);
-        m_bestLogL = m_pModel->getLogLikelihood();
+    /// Runs independent Markov chains in parallel until convergence
+    /**
+     * The first chain starts from the current model, the others are
+     * initialized from scratch with their own random number generators,
+     * which are seeded from the main one. The convergence of the chains
+     * is assessed with the Gelman-Rubin diagnostic. When the chains have
+     * converged, the first chain becomes the current model and the best
+     * state found by any of the chains becomes the best model. The chains
+     * are kept for the sampling phase.
+     *
+     * Chains that are stuck in different local optima never satisfy the
+     * diagnostic, so we give up after the number of blocks given in the
+     * arguments.
+     */
+    void runMultipleChains() {
+        int numChains = m_args.numChains, numBlocks = 0;
+        Vector samples;
+        bool converged = false;
 
-        info(">> starting Markov chain");
+        startChains(true);
+        info(">> starting %d independent Markov chains", numChains);
+
+        GelmanRubinConvergenceCriterion convCrit(numChains);
+        while (!converged) {
+            runChainsBlock(m_args.blockSize);
+
+            samples.clear();
+            for (int i = 0; i < numChains; i++) {
+                const Vector& chainSamples = m_chains[i]->samples;
+                for (Vector::const_iterator it = chainSamples.begin();
+                     it != chainSamples.end(); it++)
+                    samples.push_back(*it);
+            }
+            converged = convCrit.check(samples);
+            numBlocks++;
+            debug(">> %s", convCrit.report().c_str());
+
+            if (!converged && numBlocks >= m_args.maxNumBlocks) {
+                error(">> chains did not converge after %d blocks, giving up",
+                      numBlocks);
+                break;
+            }
+        }
+
+        m_pModel->assignFrom(m_chains[0]->pModel.get());
+    }
+
+    /// Sets up the independent Markov chains from the current model
+    /**
+     * Every chain has its own random number generator, which is seeded
+     * from the main one. The first chain starts from the current model.
+     * The other chains are initialized from scratch if \c initialize is
+     * \c true, otherwise they start from copies of the current model.
+     */
+    void startChains(bool initialize) {
+        discardParallelSamplers();
+
+        for (int i = 0; i < m_args.numChains; i++) {
+            IndependentChain* pChain = new IndependentChain();
+            m_chains.push_back(pChain);
+
+            pChain->sampler.getRNG()->init_genrand(m_mcmc.getRNG()->genrand_int32());
+            setUpSampler(&pChain->sampler);
+            pChain->pModel.reset(m_pModel->clone());
+            if (initialize && i > 0)
+                initializeModel(pChain->pModel.get(), *pChain->sampler.getRNG());
+            pChain->pBestModel.reset(pChain->pModel->clone());
+            pChain->bestLogL = pChain->pModel->getLogLikelihood();
+        }
+    }
+
+    /// Runs a single block of all the independent Markov chains in parallel
+    /**
+     * The log-likelihoods sampled after every step of a chain are collected
+     * in the \c samples vector of the chain. The best model is updated with
+     * the best state found by any of the chains.
+     */
+    void runChainsBlock(long numSteps) {
+        int numChains = m_chains.size();
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+        for (int i = 0; i < numChains; i++) {
+            IndependentChain* pChain = m_chains[i];
+            Blockmodel* pModel = pChain->pModel.get();
+
+            pChain->samples.clear();
+            for (long j = 0; j < numSteps; j++) {
+                pChain->sampler.step(pModel);
+
+                double logL = pModel->getLogLikelihood();
+                if (logL > pChain->bestLogL) {
+                    pChain->pBestModel->assignFrom(pModel);
+                    pChain->bestLogL = logL;
+                }
+                pChain->samples.push_back(logL);
+            }
+        }
+
+        for (int i = 0; i < numChains; i++) {
+            if (m_chains[i]->bestLogL > m_bestLogL) {
+                m_pBestModel->assignFrom(m_chains[i]->pBestModel.get());
+                m_bestLogL = m_chains[i]->bestLogL;
+            }
+        }
+
+        if (!isQuiet()) {
+            clog << '[' << setw(6) << m_chains[0]->sampler.getStepCount() << "] "
+                 << '(' << setw(2) << m_pModel->getNumTypes() << ") ";
+            for (int i = 0; i < numChains; i++)
+                clog << ' ' << setw(12) << m_chains[i]->pModel->getLogLikelihood();
+            clog << "\t(" << m_bestLogL << ")\n";
+        }
+
+        if (m_dumpBestStateFlag)
+            dumpBestState();
+    }
+
+    /// Runs parallel tempering from the current model until convergence
+    /**
+     * The convergence of the coldest replica is assessed the same way as
+     * for a single Markov chain. When the chains have converged, the
+     * coldest replica becomes the current model and the best state found
+     * by any of the replicas becomes the best model. The replicas are kept
+     * for the sampling phase.
+     */
+    void runParallelTempering() {
+        bool converged = false;
+        Vector samples(m_args.blockSize);
+        std::ostringstream oss;
+
+        startTempering();
 
-        // Run the Markov chain until convergence
 		std::auto_ptr<ConvergenceCriterion> pConvCrit(new EntropyConvergenceCriterion());
         while (!converged) {
-            runBlock(m_args.blockSize, samples);
+            runTemperingBlock(*m_pTempering, m_args.blockSize, samples);
 			converged = pConvCrit->check(samples);
 
 			std::string report = pConvCrit->report();
 			if (report.size() > 0)
 				debug(">> %s", report.c_str());
         }
+
+        oss << "swap acceptance rates:";
+        for (int i = 0; i + 1 < m_pTempering->getNumReplicas(); i++)
+            oss << ' ' << setprecision(3) << m_pTempering->getSwapAcceptanceRate(i);
+        info(">> %s", oss.str().c_str());
+
+        collectTemperingResults();
+    }
+
+    /// Sets up the parallel tempering replicas from the current model
+    void startTempering() {
+        std::ostringstream oss;
+
+        discardParallelSamplers();
+        m_pTempering.reset(new ParallelTempering());
+        m_pTempering->initialize(m_pModel.get(), m_args.numReplicas,
+                m_args.minTemperature, m_args.maxTemperature,
+                *m_mcmc.getRNG());
+        for (int i = 0; i < m_pTempering->getNumReplicas(); i++)
+            setUpSampler(m_pTempering->getSampler(i));
+
+        oss << "temperatures:";
+        for (int i = 0; i < m_pTempering->getNumReplicas(); i++)
+            oss << ' ' << m_pTempering->getTemperature(i);
+        info(">> starting parallel tempering with %d replicas",
+                m_pTempering->getNumReplicas());
+        debug(">> %s", oss.str().c_str());
+    }
+
+    /// Makes the coldest replica the current model and updates the best model
+    void collectTemperingResults() {
+        m_pModel->assignFrom(m_pTempering->getReplica(0));
+        if (m_pTempering->getBestLogLikelihood() > m_bestLogL) {
+            m_pBestModel->assignFrom(m_pTempering->getBestModel());
+            m_bestLogL = m_pTempering->getBestLogLikelihood();
+        }
+    }
+
+    /// Deletes the independent chains and the parallel tempering replicas
+    void discardParallelSamplers() {
+        for (size_t i = 0; i < m_chains.size(); i++)
+            delete m_chains[i];
+        m_chains.clear();
+        m_pTempering.reset();
     }
 
     /// Runs the greedy optimization process for a given blockmodel.
@@ -156,6 +535,34 @@ public:
         return true;
     }
 
+    /// Runs Kernighan-Lin style refinement passes on a given blockmodel.
+    void kernighanLinOptimization(Blockmodel* pModel) {
+        KernighanLinStrategy<Blockmodel> refinement;
+        info(">> running Kernighan-Lin refinement");
+        while (refinement.step(pModel)) {
+            double logL = pModel->getLogLikelihood();
+            if (!isQuiet()) {
+                clog << '[' << setw(6) << refinement.getStepCount() << "] "
+                     << '(' << setw(2) << pModel->getNumTypes() << ") "
+                     << setw(12) << logL << "\t(" << logL << ")\n";
+            }
+        }
+    }
+
+    /// Runs the worklist-based greedy optimization process for a given blockmodel.
+    void worklistGreedyOptimization(Blockmodel* pModel) {
+        WorklistGreedyStrategy<Blockmodel> greedy;
+        info(">> running worklist-based greedy initialization");
+        while (greedy.step(pModel)) {
+            double logL = pModel->getLogLikelihood();
+            if (!isQuiet()) {
+                clog << '[' << setw(6) << greedy.getStepCount() << "] "
+                     << '(' << setw(2) << pModel->getNumTypes() << ") "
+                     << setw(12) << logL << "\t(" << logL << ")\n";
+            }
+        }
+    }
+
     /// Returns whether we are running in quiet mode
     bool isQuiet() {
         return m_args.verbosity < 1;
@@ -166,29 +573,6 @@ public:
         return m_args.verbosity > 1;
     }
 
-    /// Loads a graph from the given file
-    /**
-     * If the name of the file is "-", the file is assumed to be the
-     * standard input.
-     */
-    std::auto_ptr<Graph> loadGraph(const std::string& filename) {
-        std::auto_ptr<Graph> result;
-
-        if (filename == "-") {
-            result.reset(new Graph(GraphUtil::readGraph(stdin, GRAPH_FORMAT_EDGELIST)));
-        } else {
-            result.reset(new Graph(GraphUtil::readGraph(filename)));
-            result->setAttribute("filename", filename);
-        }
-
-        if (!result->isSimple()) {
-            info(">> simplifying graph");
-            result->simplify();
-        }
-
-        return result;
-    }
-
     /// Dumps the best state of the model to a file on the next occasion
     /**
      * This function is called by the SIGUSR1 signal handler to signal that
@@ -205,12 +589,35 @@ public:
      * The vector is cleared at the start of the process.
      */
     void runBlock(long numSamples, Vector& samples) {
+        if (m_args.sampler == REJECTION_FREE_SAMPLER) {
+            runRejectionFreeBlock(numSamples, samples);
+        } else if (m_args.sampler == GIBBS_SAMPLER) {
+            if (m_args.useSweeps)
+                runSweepBlock(m_gibbs, numSamples, samples);
+            else
+                runStepBlock(m_gibbs, numSamples, samples);
+        } else {
+            if (m_args.useSweeps)
+                runSweepBlock(m_mcmc, numSamples, samples);
+            else
+                runStepBlock(m_mcmc, numSamples, samples);
+        }
+    }
+
+    /// Runs a single block of the Markov chain with the given sampler
+    /**
+     * The log-likelihood is sampled after every step. The log-likelihoods
+     * are collected in the given vector, which is cleared at the start of
+     * the process.
+     */
+    template <typename Sampler>
+    void runStepBlock(Sampler& sampler, long numSamples, Vector& samples) {
         double logL;
 		Blockmodel* pModel = m_pModel.get();
 
         samples.clear();
         while (numSamples > 0) {
-            m_mcmc.step(pModel);
+            sampler.step(pModel);
 
             logL = pModel->getLogLikelihood();
             if (m_bestLogL < logL) {
@@ -220,12 +627,12 @@ public:
             }
             samples.push_back(logL);
 
-            if (m_mcmc.getStepCount() % m_args.logPeriod == 0 && !isQuiet()) {
-                clog << '[' << setw(6) << m_mcmc.getStepCount() << "] "
+            if (sampler.getStepCount() % m_args.logPeriod == 0 && !isQuiet()) {
+                clog << '[' << setw(6) << sampler.getStepCount() << "] "
                      << '(' << setw(2) << pModel->getNumTypes() << ") "
                      << setw(12) << logL << "\t(" << m_bestLogL << ")\t"
-                     << (m_mcmc.wasLastProposalAccepted() ? '*' : ' ')
-                     << setw(8) << m_mcmc.getAcceptanceRatio()
+                     << (sampler.wasLastProposalAccepted() ? '*' : ' ')
+                     << setw(8) << sampler.getAcceptanceRatio()
                      << '\n';
             }
 
@@ -236,81 +643,330 @@ public:
         }
     }
 
-    /// Runs the sampling until hell freezes over
-    void runUntilHellFreezesOver() {
-        Vector dummy;
-
-        while (1)
-            runBlock(1000, dummy);
-    }
+    /// Runs a single block of the Markov chain in sweeps over all the vertices
+    /**
+     * The block consists of the smallest number of sweeps of the given
+     * sampler that contain at least the given number of steps. The
+     * log-likelihood is sampled, the best model is updated and the progress
+     * is reported after every block of vertices within the sweeps (but not
+     * more often than the log period), so the convergence criterion gets
+     * several samples even if a single sweep is longer than the block. The
+     * log-likelihoods are collected in the given vector, which is cleared
+     * at the start of the process.
+     */
+    template <typename Sampler>
+    void runSweepBlock(Sampler& sampler, long numSteps, Vector& samples) {
+        double logL;
+		Blockmodel* pModel = m_pModel.get();
+        long n = pModel->getGraph()->vcount();
 
-    /// Runs the user interface
-    int run(int argc, char** argv) {
-        m_args.parse(argc, argv);
+        samples.clear();
+        while (numSteps > 0) {
+            long numBlocks = sampler.startSweep(pModel);
+            m_numSweeps++;
+            numSteps -= n;
 
-        switch (m_args.outputFormat) {
-            case FORMAT_JSON:
-                m_pModelWriter.reset(new JSONWriter<Blockmodel>);
-                break;
+            for (long b = 0; b < numBlocks; b++) {
+                int oldStepCount = sampler.getStepCount();
 
-			case FORMAT_NULL:
-                m_pModelWriter.reset(new NullWriter<Blockmodel>);
-                break;
+                sampler.sweepBlock(pModel, b);
 
-            default:
-                m_pModelWriter.reset(new PlainTextWriter<Blockmodel>);
-        };
+                logL = pModel->getLogLikelihood();
+                if (m_bestLogL < logL) {
+                    m_pBestModel->assignFrom(m_pModel);
+                    m_bestLogL = logL;
+                }
+                samples.push_back(logL);
 
-        info(">> loading graph: %s", m_args.inputFile.c_str());
-        m_pGraph = loadGraph(m_args.inputFile);
-        info(">> graph has %ld vertices and %ld edges",
-             (long)m_pGraph->vcount(), (long)m_pGraph->ecount());
+                if (sampler.getStepCount() / m_args.logPeriod !=
+                        oldStepCount / m_args.logPeriod && !isQuiet()) {
+                    clog << "[sweep " << setw(6) << m_numSweeps << "] "
+                         << '(' << setw(2) << pModel->getNumTypes() << ") "
+                         << setw(12) << logL << "\t(" << m_bestLogL << ")\t"
+                         << setw(8) << sampler.getAcceptanceRatio()
+                         << '\n';
+                }
 
-        debug(">> using random seed: %lu", m_args.randomSeed);
-        m_mcmc.getRNG()->init_genrand(m_args.randomSeed);
+                if (m_dumpBestStateFlag)
+                    dumpBestState();
+            }
+        }
+    }
 
-        if (m_args.numGroups > 0) {
-            /* Run the Markov chain until it converges */
-            fitForGivenGroupCount(m_args.numGroups);
-            info(">> AIC = %.4f", aic(*m_pModel));
-        } else {
-			std::auto_ptr<Blockmodel> pModelWithBestTypeCount =
-                constructNewModel(m_pGraph.get(), 1);
-            double currentAIC, bestAIC = std::numeric_limits<double>::infinity();
+    /// Runs a single block of the Markov chain with the rejection-free sampler
+    /**
+     * The block consists of the given number of equivalent Metropolis-Hastings
+     * steps. Every draw of the sampler stands for the number of steps the
+     * Metropolis-Hastings chain would have spent in the old state before the
+     * move, so the log-likelihood of the old state is repeated accordingly in
+     * the samples, followed by the one of the new state. The last draw of the
+     * block is cut at the end of the block. The log-likelihoods are collected
+     * in the given vector, which is cleared at the start of the process.
+     */
+    void runRejectionFreeBlock(long numSteps, Vector& samples) {
+        double logL, oldLogL;
+		Blockmodel* pModel = m_pModel.get();
 
-            /* Find the optimal type count */
-            int kMax = floor(sqrt(m_pGraph->vcount()));
-            if (kMax < 1)
-                kMax = 1;
-            for (int k = 1; k <= kMax; k++) {
-                if (k == 1)
-                    info(">> trying with 1 type");
-                else
-                    info(">> trying with %d types", k);
-                fitForGivenGroupCount(k);
-                currentAIC = aic(*m_pBestModel);
-                if (currentAIC < bestAIC) {
-                    bestAIC = currentAIC;
-                    pModelWithBestTypeCount->assignFrom(m_pBestModel);
-                }
-                debug(">> AIC = %.4f (%.4f)", currentAIC, bestAIC);
-            }
+        samples.clear();
+        while (numSteps > 0) {
+            long oldStepCount = static_cast<long>(m_rejectionFree.getEquivalentStepCount());
 
-            m_pModel->assignFrom(pModelWithBestTypeCount);
-            m_pBestModel->assignFrom(pModelWithBestTypeCount);
+            oldLogL = pModel->getLogLikelihood();
+            m_rejectionFree.step(pModel);
 
-            m_bestLogL = m_pModel->getLogLikelihood();
-            info(">> best type count is %d", m_pModel->getNumTypes());
-        }
+            long waitingTime = std::min(m_rejectionFree.getLastWaitingTime(), numSteps);
+            for (long i = 1; i < waitingTime; i++)
+                samples.push_back(oldLogL);
+            numSteps -= waitingTime;
+
+            logL = pModel->getLogLikelihood();
+            if (m_bestLogL < logL) {
+                m_pBestModel->assignFrom(m_pModel);
+                m_bestLogL = logL;
+            }
+            samples.push_back(logL);
+
+            long stepCount = static_cast<long>(m_rejectionFree.getEquivalentStepCount());
+            if (stepCount / m_args.logPeriod != oldStepCount / m_args.logPeriod &&
+                    !isQuiet()) {
+                clog << '[' << setw(6) << stepCount << "] "
+                     << '(' << setw(2) << pModel->getNumTypes() << ") "
+                     << setw(12) << logL << "\t(" << m_bestLogL << ")\t"
+                     << (m_rejectionFree.wasLastProposalAccepted() ? '*' : ' ')
+                     << setw(8) << m_rejectionFree.getAcceptanceRatio()
+                     << '\n';
+            }
+
+            if (m_dumpBestStateFlag)
+                dumpBestState();
+        }
+
+        debug(">> rejection-free sampler: %ld exceeded bounds found so far",
+              m_rejectionFree.getNumBoundViolations());
+    }
+
+    /// Runs a single block of parallel tempering
+    /**
+     * The log-likelihoods sampled from the coldest replica are collected in
+     * the given vector. The vector is cleared at the start of the process.
+     */
+    void runTemperingBlock(ParallelTempering& tempering, long numSamples,
+            Vector& samples) {
+        samples.clear();
+        while (numSamples > 0) {
+            long numSteps = std::min(numSamples, m_args.swapPeriod);
+            const MetropolisHastingsStrategy* pColdSampler = tempering.getSampler(0);
+            int oldStepCount = pColdSampler->getStepCount();
+
+            tempering.runRound(numSteps, &samples);
+            numSamples -= numSteps;
+
+            if (pColdSampler->getStepCount() / m_args.logPeriod !=
+                    oldStepCount / m_args.logPeriod && !isQuiet()) {
+                const Blockmodel* pColdModel = tempering.getReplica(0);
+                clog << '[' << setw(6) << pColdSampler->getStepCount() << "] "
+                     << '(' << setw(2) << pColdModel->getNumTypes() << ") "
+                     << setw(12) << pColdModel->getLogLikelihood() << "\t("
+                     << tempering.getBestLogLikelihood() << ")\t"
+                     << setw(8) << pColdSampler->getAcceptanceRatio() << "\t";
+                for (int i = 0; i + 1 < tempering.getNumReplicas(); i++)
+                    clog << ' ' << setw(6) << setprecision(3)
+                         << tempering.getSwapAcceptanceRate(i);
+                clog << setprecision(6) << '\n';
+            }
+
+            if (m_dumpBestStateFlag) {
+                m_pBestModel->assignFrom(tempering.getBestModel());
+                m_bestLogL = tempering.getBestLogLikelihood();
+                dumpBestState();
+            }
+        }
+    }
+
+    /// Runs the given number of Markov chain steps on the current model
+    /**
+     * Models with less than two groups have only one state, so nothing is
+     * done for them.
+     */
+    void runSteps(long numSteps) {
+        Vector samples;
+
+        if (m_pModel->getNumTypes() < 2)
+            return;
+
+        samples.reserve(numSteps);
+        runBlock(numSteps, samples);
+    }
+
+    /// Merges the cheapest pair of groups and runs a few steps on the result
+    /**
+     * The merge starts from the best model found so far. The best model is
+     * then reset to the merged one, as the models with more groups are not
+     * comparable to it.
+     *
+     * \param  merger    the merger initialized from the current model
+     * \param  numSteps  the number of Markov chain steps after the merge
+     */
+    void mergeGroups(GroupMerger& merger, long numSteps) {
+        m_pModel->assignFrom(m_pBestModel);
+        merger.mergeCheapestPair(m_pModel.get());
+        m_rejectionFree.reset();
+        discardParallelSamplers();
+
+        m_pBestModel->assignFrom(m_pModel);
+        m_bestLogL = m_pModel->getLogLikelihood();
+        runSteps(numSteps);
+    }
+
+    /// Samples the number of groups with merge-split moves until convergence
+    /**
+     * The point moves of the Markov chain are interleaved with a merge or
+     * split proposal after every \c period steps, so the number of groups
+     * changes along the chain. The samples are penalized log-likelihoods,
+     * i.e. the log-likelihood plus the log-prior of the number of groups,
+     * and the best model is the one with the best penalized log-likelihood.
+     * Empty groups of the starting model are removed, and point moves that
+     * would empty a group are rejected, so only merges remove groups.
+     *
+     * \param  penalty  the penalty of a block parameter in the log-likelihood
+     * \param  period   the number of Markov chain steps between merge-split
+     *                  proposals
+     */
+    void runMergeSplitUntilConvergence(double penalty, long period) {
+        MergeSplitStrategy mergeSplit(penalty);
+		Blockmodel* pModel = m_pModel.get();
+        Vector samples(m_args.blockSize);
+        bool converged = false;
+        long numSteps = 0;
+        double score, bestScore;
+
+        mergeSplit.getRNG()->init_genrand(m_mcmc.getRNG()->genrand_int32());
+
+        // The chain moves between models without empty groups only
+        for (int type = pModel->getNumTypes() - 1; type >= 0; type--) {
+            if (pModel->getTypeCount(type) == 0 && pModel->getNumTypes() > 1)
+                pModel->removeEmptyType(type);
+        }
+        m_mcmc.setKeepGroupsNonEmpty(true);
+
+        m_pBestModel->assignFrom(m_pModel);
+        bestScore = pModel->getLogLikelihood() +
+            mergeSplit.getLogPrior(pModel->getNumTypes());
+
+        info(">> starting Markov chain with merge-split moves");
+
+		std::auto_ptr<ConvergenceCriterion> pConvCrit(new EntropyConvergenceCriterion());
+        while (!converged) {
+            samples.clear();
+            for (long i = 0; i < m_args.blockSize; i++) {
+                numSteps++;
+                if (pModel->getNumTypes() > 1)
+                    m_mcmc.step(pModel);
+                if (numSteps % period == 0)
+                    mergeSplit.step(pModel);
+
+                score = pModel->getLogLikelihood() +
+                    mergeSplit.getLogPrior(pModel->getNumTypes());
+                if (bestScore < score) {
+                    m_pBestModel->assignFrom(m_pModel);
+                    bestScore = score;
+                }
+                samples.push_back(score);
+
+                if (numSteps % m_args.logPeriod == 0 && !isQuiet()) {
+                    clog << '[' << setw(6) << numSteps << "] "
+                         << '(' << setw(2) << pModel->getNumTypes() << ") "
+                         << setw(12) << score << "\t(" << bestScore << ")\t"
+                         << setw(8) << m_mcmc.getAcceptanceRatio() << ' '
+                         << setw(8) << mergeSplit.getAcceptanceRatio()
+                         << '\n';
+                }
+            }
+
+			converged = pConvCrit->check(samples);
+
+			std::string report = pConvCrit->report();
+			if (report.size() > 0)
+				debug(">> %s", report.c_str());
+        }
+
+        m_mcmc.setKeepGroupsNonEmpty(false);
+        m_bestLogL = m_pBestModel->getLogLikelihood();
+    }
+
+    /// Runs the sampling until hell freezes over
+    void runUntilHellFreezesOver() {
+        while (1)
+            continueSampling(1000);
+    }
+
+    /// Continues the selected sampling method after convergence
+    /**
+     * Multiple chains and parallel tempering continue from the state they
+     * converged to; if the fitter starts from a given model (see
+     * \ref startFrom), they are set up from that model first, and the
+     * chains start from copies of it. The current model follows the first
+     * chain or the coldest replica, respectively.
+     *
+     * \param  numSteps  the number of steps of every chain or replica
+     */
+    void continueSampling(long numSteps) {
+        Vector samples;
+
+        if (m_args.numChains > 1) {
+            if (m_chains.empty())
+                startChains(false);
+            while (numSteps > 0) {
+                long blockSize = std::min(numSteps, static_cast<long>(m_args.blockSize));
+                runChainsBlock(blockSize);
+                numSteps -= blockSize;
+            }
+            m_pModel->assignFrom(m_chains[0]->pModel.get());
+        } else if (m_args.numReplicas > 1) {
+            if (!m_pTempering.get())
+                startTempering();
+            runTemperingBlock(*m_pTempering, numSteps, samples);
+            collectTemperingResults();
+        } else {
+            samples.reserve(numSteps);
+            runBlock(numSteps, samples);
+        }
+    }
+
+    /// Returns the best model found so far
+    const Blockmodel* getBestModel() const {
+        return m_pBestModel.get();
+    }
+
+    /// Returns the model being fitted
+    const Blockmodel* getModel() const {
+        return m_pModel.get();
+    }
+
+    /// Returns the random number generator of the fitting process
+    MersenneTwister* getRNG() {
+        return m_mcmc.getRNG();
+    }
+
+    /// Takes samples from the Markov chain after convergence
+    /**
+     * The chain runs indefinitely if the number of samples to be taken
+     * is not positive. With multiple chains or parallel tempering, every
+     * chain or replica takes the given number of samples (see
+     * \ref continueSampling). The best state is dumped at the end.
+     * Simulated annealing gives a point estimate, so its best state is
+     * dumped right away.
+     */
+    void sample() {
+        if (m_args.mode == ANNEALING_MODE) {
+            dumpBestState();
+            return;
+        }
 
-        /* Start sampling */
         if (m_args.numSamples > 0) {
             /* taking a finite number of samples */
-            Vector samples;
-
             info(">> convergence condition satisfied, taking %d samples", m_args.numSamples);
-            samples.reserve(m_args.numSamples);
-            runBlock(m_args.numSamples, samples);
+            continueSampling(m_args.numSamples);
         } else {
             /* leave the Markov chain running anyway */
             info(">> convergence condition satisfied, leaving the chain running anyway");
@@ -322,6 +978,549 @@ public:
 
         /* Dump the best solution found */
         dumpBestState();
+    }
+
+    /// Makes the fitter continue from a copy of the given model
+    void startFrom(const Blockmodel* pModel) {
+        m_pModel.reset(pModel->clone());
+        m_pBestModel.reset(pModel->clone());
+        m_bestLogL = m_pModel->getLogLikelihood();
+        m_rejectionFree.reset();
+        discardParallelSamplers();
+    }
+};
+
+class BlockmodelFittingApp {
+private:
+    /// Parsed command line arguments
+    CommandLineArguments m_args;
+
+    /// Graph being analyzed by the UI
+    std::auto_ptr<Graph> m_pGraph;
+
+    /// Model of the graph with a single group
+    /**
+     * Every fitter clones its models from the prototype, so the adjacency
+     * lists of the graph are built only once and shared by all the models.
+     */
+    std::auto_ptr<Blockmodel> m_pPrototype;
+
+    /// Fitter that runs the sampling process on the final model
+    std::auto_ptr<BlockmodelFitter> m_pFitter;
+
+    /// Writer object that is used to dump the best state
+    std::auto_ptr<Writer<Blockmodel> > m_pModelWriter;
+
+public:
+    LOGGING_FUNCTION(debug, 2);
+    LOGGING_FUNCTION(info, 1);
+    LOGGING_FUNCTION(warning, 0);
+    LOGGING_FUNCTION(error, 0);
+
+    /// Constructor
+    BlockmodelFittingApp() : m_pGraph(0), m_pPrototype(0), m_pFitter(0),
+        m_pModelWriter(0) {}
+
+    /// Fits models with all the group counts from 1 to sqrt(n)
+    /**
+     * The group counts are fitted concurrently by a pool of workers, largest
+     * group count first, as the larger group counts take longer to converge.
+     * Every group count has its own fitter whose random number generator is
+     * seeded from the given one in the order of the group counts, so the
+     * results do not depend on the number of workers.
+     *
+     * With warm starts, the group counts are fitted one by one in
+     * increasing order and every group count starts from the best model of
+     * the previous one with one of its groups split in two.
+     *
+     * \return  the model with the best value of the information criterion;
+     *          ties are broken in favour of the smaller group count
+     */
+    std::auto_ptr<Blockmodel> findBestGroupCount(MersenneTwister& rng) {
+        if (m_args.kSearchMethod == SUCCESSIVE_HALVING)
+            return findBestGroupCountByHalving(rng);
+        if (m_args.kSearchMethod == AGGLOMERATIVE_MERGING)
+            return findBestGroupCountByMerging(rng);
+        if (m_args.kSearchMethod == MERGE_SPLIT)
+            return findBestGroupCountByMergeSplit(rng);
+
+        int kMax = getMaxGroupCount();
+
+        std::vector<unsigned long> seeds(kMax + 1);
+        for (int k = 1; k <= kMax; k++)
+            seeds[k] = rng.genrand_int32();
+
+        std::vector<double> aics(kMax + 1);
+        std::auto_ptr<Blockmodel> pBestModel;
+        int bestK = 0;
+
+        if (m_args.warmStart) {
+            // Every group count starts from the result of the previous one,
+            // so the group counts have to be fitted one by one
+            std::auto_ptr<Blockmodel> pPreviousModel;
+            for (int k = 1; k <= kMax; k++) {
+                if (k == 1)
+                    info(">> trying with 1 type");
+                else
+                    info(">> trying with %d types", k);
+
+                BlockmodelFitter fitter(m_args, m_pPrototype.get(), 0, seeds[k]);
+                if (k == 1)
+                    fitter.fitForGivenGroupCount(k);
+                else
+                    fitter.fitBySplittingGroup(pPreviousModel.get());
+
+                aics[k] = informationCriterion(*fitter.getBestModel());
+                if (bestK == 0 || aics[k] < aics[bestK]) {
+                    pBestModel.reset(fitter.getBestModel()->clone());
+                    bestK = k;
+                }
+                pPreviousModel.reset(fitter.getBestModel()->clone());
+                debug(">> %s = %.4f (%.4f)", getCriterionName(), aics[k],
+                      aics[bestK]);
+            }
+            return pBestModel;
+        }
+
+        int numJobs = m_args.numJobs > 0 ? m_args.numJobs : getMaxThreadCount();
+        numJobs = std::min(numJobs, kMax);
+
+        // The workers report their progress only if they run one at a time,
+        // otherwise their messages would be interleaved
+        CommandLineArguments workerArgs(m_args);
+        if (numJobs > 1) {
+            info(">> trying 1 to %d types with %d workers", kMax, numJobs);
+            workerArgs.verbosity = 0;
+        }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1) num_threads(numJobs)
+#endif
+        for (int i = 0; i < kMax; i++) {
+            int k = kMax - i;
+            if (numJobs == 1) {
+                if (k == 1)
+                    info(">> trying with 1 type");
+                else
+                    info(">> trying with %d types", k);
+            }
+
+            BlockmodelFitter fitter(workerArgs, m_pPrototype.get(), 0, seeds[k]);
+            fitter.fitForGivenGroupCount(k);
+            aics[k] = informationCriterion(*fitter.getBestModel());
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+            {
+                if (bestK == 0 || aics[k] < aics[bestK] ||
+                        (aics[k] == aics[bestK] && k < bestK)) {
+                    pBestModel.reset(fitter.getBestModel()->clone());
+                    bestK = k;
+                }
+            }
+        }
+
+        double bestAIC = std::numeric_limits<double>::infinity();
+        for (int k = 1; k <= kMax; k++) {
+            bestAIC = std::min(bestAIC, aics[k]);
+            debug(">> %s with %d types = %.4f (%.4f)", getCriterionName(), k,
+                  aics[k], bestAIC);
+        }
+
+        return pBestModel;
+    }
+
+    /// Searches for the best group count by successive halving
+    /**
+     * Every group count from 1 to sqrt(n) gets a small budget of Markov
+     * chain steps first. The group counts are then ranked by the best
+     * value of the information criterion seen so far, the worse half of
+     * them is dropped and the budget of the others is doubled. The rounds
+     * are repeated until only a few group counts remain, which are then
+     * run until convergence. Most of the time is thus spent on the
+     * promising group counts instead of those that are obviously worse.
+     *
+     * The group counts within a round are run concurrently and every
+     * group count has its own random number generator seeded from the
+     * given one, so the results do not depend on the number of workers.
+     * The models of all the fitters are cloned from the prototype and share
+     * its adjacency lists, so a group count of the first round takes memory
+     * linear in the number of vertices only (unless the neighbor type cache
+     * is enabled). The fitter of a group count is deleted as soon as the
+     * group count is dropped, and only the best model of a finalist is kept
+     * after it has converged.
+     *
+     * \return  the model with the best value of the information criterion;
+     *          ties are broken in favour of the smaller group count
+     */
+    std::auto_ptr<Blockmodel> findBestGroupCountByHalving(MersenneTwister& rng) {
+        const size_t numFinalists = 2;
+        int kMax = getMaxGroupCount();
+        long budget = m_args.kSearchBudget;
+
+        std::vector<unsigned long> seeds(kMax + 1);
+        for (int k = 1; k <= kMax; k++)
+            seeds[k] = rng.genrand_int32();
+
+        int numJobs = m_args.numJobs > 0 ? m_args.numJobs : getMaxThreadCount();
+        numJobs = std::min(numJobs, kMax);
+
+        // The progress of the individual group counts is not shown, their
+        // messages would be interleaved
+        CommandLineArguments workerArgs(m_args);
+        workerArgs.verbosity = 0;
+
+        std::vector<BlockmodelFitter*> fitters(kMax + 1);
+        std::vector<int> candidates;
+        for (int k = 1; k <= kMax; k++)
+            candidates.push_back(k);
+
+        while (candidates.size() > numFinalists) {
+            long numCandidates = candidates.size();
+            std::vector<std::pair<double, int> > ranking(numCandidates);
+
+            info(">> running %ld group counts for %ld steps", numCandidates,
+                 budget);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1) num_threads(numJobs)
+#endif
+            for (long i = 0; i < numCandidates; i++) {
+                // Larger group counts are slower, so they are started first
+                int k = candidates[numCandidates - i - 1];
+                // The fitters are created in the first round, right before
+                // they are needed
+                if (fitters[k] == 0) {
+                    fitters[k] = new BlockmodelFitter(workerArgs,
+                            m_pPrototype.get(), 0, seeds[k]);
+                    fitters[k]->initializeForGivenGroupCount(k);
+                }
+                fitters[k]->runSteps(budget);
+                ranking[numCandidates - i - 1] = std::make_pair(
+                        informationCriterion(*fitters[k]->getBestModel()), k);
+            }
+
+            std::sort(ranking.begin(), ranking.end());
+            for (long i = 0; i < numCandidates; i++) {
+                debug(">> %s with %d types = %.4f", getCriterionName(),
+                      ranking[i].second, ranking[i].first);
+            }
+
+            size_t numKept = std::max((candidates.size() + 1) / 2, numFinalists);
+            candidates.clear();
+            for (long i = 0; i < numCandidates; i++) {
+                int k = ranking[i].second;
+                if (candidates.size() < numKept) {
+                    candidates.push_back(k);
+                } else {
+                    delete fitters[k];
+                    fitters[k] = 0;
+                }
+            }
+            std::sort(candidates.begin(), candidates.end());
+            budget *= 2;
+        }
+
+        long numCandidates = candidates.size();
+        std::vector<double> values(numCandidates);
+        std::vector<Blockmodel*> bestModels(numCandidates);
+        info(">> running %ld group counts until convergence", numCandidates);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1) num_threads(numJobs)
+#endif
+        for (long i = 0; i < numCandidates; i++) {
+            long index = numCandidates - i - 1;
+            int k = candidates[index];
+            if (k >= 2)
+                fitters[k]->continueUntilConvergence();
+            values[index] = informationCriterion(*fitters[k]->getBestModel());
+
+            // Only the best model of the fitter is needed from now on
+            bestModels[index] = fitters[k]->getBestModel()->clone();
+            delete fitters[k];
+            fitters[k] = 0;
+        }
+
+        std::auto_ptr<Blockmodel> pBestModel;
+        double bestValue = std::numeric_limits<double>::infinity();
+        for (long i = 0; i < numCandidates; i++) {
+            debug(">> %s with %d types = %.4f", getCriterionName(),
+                  candidates[i], values[i]);
+            if (values[i] < bestValue) {
+                pBestModel.reset(bestModels[i]);
+                bestValue = values[i];
+            } else {
+                delete bestModels[i];
+            }
+        }
+
+        return pBestModel;
+    }
+
+    /// Searches for the best group count by merging the groups of a single model
+    /**
+     * A model with sqrt(n) groups is fitted until convergence first. The
+     * pair of groups whose merge decreases the log-likelihood the least is
+     * then merged repeatedly, with a few Markov chain steps after every
+     * merge to polish the result, until only one group remains. This gives
+     * the information criterion for every group count in a single pass.
+     *
+     * \return  the model with the best value of the information criterion;
+     *          ties are broken in favour of the smaller group count
+     */
+    std::auto_ptr<Blockmodel> findBestGroupCountByMerging(MersenneTwister& rng) {
+        int kMax = getMaxGroupCount();
+        BlockmodelFitter fitter(m_args, m_pPrototype.get(), 0, rng.genrand_int32());
+        GroupMerger merger;
+        std::vector<double> values(kMax + 1);
+        std::auto_ptr<Blockmodel> pBestModel;
+        int bestK = kMax;
+
+        info(">> trying with %d types", kMax);
+        fitter.fitForGivenGroupCount(kMax);
+        pBestModel.reset(fitter.getBestModel()->clone());
+        values[kMax] = informationCriterion(*pBestModel);
+        merger.initialize(pBestModel.get());
+
+        info(">> merging groups");
+        for (int k = kMax - 1; k >= 1; k--) {
+            fitter.mergeGroups(merger, m_args.kSearchBudget);
+            values[k] = informationCriterion(*fitter.getBestModel());
+            if (values[k] <= values[bestK]) {
+                pBestModel.reset(fitter.getBestModel()->clone());
+                bestK = k;
+            }
+        }
+
+        for (int k = 1; k <= kMax; k++)
+            info(">> %s with %d types = %.4f", getCriterionName(), k, values[k]);
+
+        return pBestModel;
+    }
+
+    /// Samples the number of groups with a single chain using merge-split moves
+    /**
+     * The chain starts from a model with sqrt(n) groups and the number of
+     * groups is sampled along with the groups of the vertices. The prior
+     * of the number of groups is chosen so that the mode of the penalized
+     * log-likelihood is the model with the best information criterion.
+     *
+     * \return  the model with the best penalized log-likelihood
+     */
+    std::auto_ptr<Blockmodel> findBestGroupCountByMergeSplit(MersenneTwister& rng) {
+        int kMax = getMaxGroupCount();
+        BlockmodelFitter fitter(m_args, m_pPrototype.get(), 0, rng.genrand_int32());
+        double penalty = 1.0;
+
+        info(">> starting from %d types", kMax);
+        fitter.initializeForGivenGroupCount(kMax);
+
+        // The AIC penalizes every parameter by 1 in the log-likelihood, the
+        // BIC by log(n)/2
+        if (m_args.criterion == BIC)
+            penalty = std::log(fitter.getModel()->getNumObservations()) / 2.0;
+        fitter.runMergeSplitUntilConvergence(penalty, m_args.mergeSplitPeriod);
+
+        std::auto_ptr<Blockmodel> pBestModel(fitter.getBestModel()->clone());
+        info(">> %s with %d types = %.4f", getCriterionName(),
+             pBestModel->getNumTypes(), informationCriterion(*pBestModel));
+        return pBestModel;
+    }
+
+    /// Constructs the prototype of the models fitted to the loaded graph
+    std::auto_ptr<Blockmodel> constructPrototype() {
+        std::auto_ptr<Blockmodel> result;
+
+        switch (m_args.modelType) {
+            case UNDIRECTED_BLOCKMODEL:
+                result.reset(new UndirectedBlockmodel());
+                break;
+
+            case DEGREE_CORRECTED_UNDIRECTED_BLOCKMODEL:
+                result.reset(new DegreeCorrectedUndirectedBlockmodel());
+                break;
+
+            default:
+                throw std::runtime_error("invalid model type given");
+        }
+
+        result->setNeighborTypeCacheEnabled(m_args.useNeighborTypeCache);
+        result->setGraph(m_pGraph.get());
+        result->setNumTypes(1);
+
+        return result;
+    }
+
+    /// Returns the largest group count tried when the group count is detected
+    int getMaxGroupCount() const {
+        int kMax = floor(sqrt(m_pGraph->vcount()));
+        return kMax < 1 ? 1 : kMax;
+    }
+
+    /// Returns the name of the selected information criterion
+    const char* getCriterionName() const {
+        return m_args.criterion == BIC ? "BIC" : "AIC";
+    }
+
+    /// Calculates the selected information criterion for a model
+    double informationCriterion(const Blockmodel& model) const {
+        return m_args.criterion == BIC ? bic(model) : aic(model);
+    }
+
+    /// Loads a graph from the given file
+    /**
+     * If the name of the file is "-", the file is assumed to be the
+     * standard input.
+     */
+    std::auto_ptr<Graph> loadGraph(const std::string& filename) {
+        std::auto_ptr<Graph> result;
+
+        if (filename == "-") {
+            result.reset(new Graph(GraphUtil::readGraph(stdin, GRAPH_FORMAT_EDGELIST)));
+        } else {
+            result.reset(new Graph(GraphUtil::readGraph(filename)));
+            result->setAttribute("filename", filename);
+        }
+
+        if (!result->isSimple()) {
+            info(">> simplifying graph");
+            result->simplify();
+        }
+
+        return result;
+    }
+
+    /// Dumps the best state of the model to a file on the next occasion
+    /**
+     * This function is called by the SIGUSR1 signal handler to signal that
+     * we should dump the best state as soon as possible. The request is
+     * ignored while the group count is being determined.
+     */
+    void raiseDumpBestStateFlag() {
+        if (m_pFitter.get())
+            m_pFitter->raiseDumpBestStateFlag();
+    }
+
+    /// Runs the user interface
+    int run(int argc, char** argv) {
+        m_args.parse(argc, argv);
+
+        if (m_args.numChains > 1 && m_args.numReplicas > 1) {
+            error("Multiple chains cannot be combined with parallel tempering");
+            return 1;
+        }
+
+        if (m_args.useSweeps && (m_args.numChains > 1 || m_args.numReplicas > 1)) {
+            error("Sweeps cannot be combined with multiple chains or parallel "
+                  "tempering");
+            return 1;
+        }
+
+        if (m_args.sampler == REJECTION_FREE_SAMPLER &&
+                (m_args.numChains > 1 || m_args.numReplicas > 1 ||
+                 m_args.useSweeps || m_args.proposal != UNIFORM_PROPOSAL)) {
+            error("The rejection-free sampler cannot be combined with multiple "
+                  "chains, parallel tempering, sweeps or the neighbor proposal");
+            return 1;
+        }
+
+        if (m_args.mode == ANNEALING_MODE &&
+                (m_args.numChains > 1 || m_args.numReplicas > 1 ||
+                 m_args.useSweeps || m_args.sampler != METROPOLIS_SAMPLER ||
+                 m_args.kSearchMethod != FULL_SEARCH)) {
+            error("Simulated annealing cannot be combined with multiple chains, "
+                  "parallel tempering, sweeps, other samplers or group count "
+                  "searches other than the full search");
+            return 1;
+        }
+
+        if (m_args.sampler == GIBBS_SAMPLER &&
+                (m_args.numChains > 1 || m_args.numReplicas > 1 ||
+                 m_args.proposal != UNIFORM_PROPOSAL)) {
+            error("The Gibbs sampler cannot be combined with multiple chains, "
+                  "parallel tempering or the neighbor proposal");
+            return 1;
+        }
+
+        if (m_args.kSearchMethod == MERGE_SPLIT &&
+                (m_args.numChains > 1 || m_args.numReplicas > 1 ||
+                 m_args.useSweeps || m_args.sampler != METROPOLIS_SAMPLER)) {
+            error("The merge-split group count search cannot be combined with "
+                  "multiple chains, parallel tempering, sweeps or other samplers");
+            return 1;
+        }
+
+        if (m_args.warmStart && m_args.kSearchMethod != FULL_SEARCH) {
+            error("Warm starts can only be used with the full group count search");
+            return 1;
+        }
+
+        if (m_args.finalTemperature > m_args.initialTemperature) {
+            error("The final temperature must not be greater than the "
+                  "initial temperature");
+            return 1;
+        }
+
+        if (m_args.maxTemperature < m_args.minTemperature) {
+            error("The maximum temperature must not be less than the "
+                  "minimum temperature");
+            return 1;
+        }
+
+        if (m_args.sampler == REJECTION_FREE_SAMPLER &&
+                m_args.rejectionFreeRefreshPeriod != 1) {
+            warning("Warning: the rejection-free sampler is approximate and "
+                    "its samples may be biased unless --rejection-free-refresh "
+                    "is 1");
+        }
+
+        switch (m_args.outputFormat) {
+            case FORMAT_JSON:
+                m_pModelWriter.reset(new JSONWriter<Blockmodel>);
+                break;
+
+			case FORMAT_NULL:
+                m_pModelWriter.reset(new NullWriter<Blockmodel>);
+                break;
+
+            default:
+                m_pModelWriter.reset(new PlainTextWriter<Blockmodel>);
+        };
+
+        info(">> loading graph: %s", m_args.inputFile.c_str());
+        m_pGraph = loadGraph(m_args.inputFile);
+        info(">> graph has %ld vertices and %ld edges",
+             (long)m_pGraph->vcount(), (long)m_pGraph->ecount());
+
+        // The x*log(x) arguments of the likelihood terms are at most the
+        // number of vertices or twice the number of edges. The table must
+        // be extended before any parallel region reads it
+        XLogXTable::reserve(std::max(static_cast<long>(m_pGraph->vcount()),
+                    2 * static_cast<long>(m_pGraph->ecount())) + 1);
+
+        // The prototype is built here, before the fitters of the group
+        // count search may run in parallel
+        m_pPrototype = constructPrototype();
+
+        debug(">> using random seed: %lu", m_args.randomSeed);
+        std::auto_ptr<BlockmodelFitter> pFitter(new BlockmodelFitter(m_args,
+                    m_pPrototype.get(), m_pModelWriter.get(), m_args.randomSeed));
+
+        if (m_args.numGroups > 0) {
+            /* Run the Markov chain until it converges */
+            pFitter->fitForGivenGroupCount(m_args.numGroups);
+            info(">> AIC = %.4f", aic(*pFitter->getModel()));
+        } else {
+            /* Find the optimal type count */
+            std::auto_ptr<Blockmodel> pModelWithBestTypeCount =
+                findBestGroupCount(*pFitter->getRNG());
+            pFitter->startFrom(pModelWithBestTypeCount.get());
+            info(">> best type count is %d", pModelWithBestTypeCount->getNumTypes());
+        }
+
+        /* Start sampling */
+        m_pFitter = pFitter;
+        m_pFitter->sample();
         return 0;
     }
 };
@@ -0,0 +1,123 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#include <cmath>
+#include <cstdlib>
+#include <igraph/cpp/edge_selector.h>
+#include <igraph/cpp/graph.h>
+#include <igraph/cpp/generators/full.h>
+#include <igraph/cpp/generators/ring.h>
+#include <block/blockmodel.h>
+#include <block/optimization.hpp>
+
+#include "test_common.cpp"
+
+using namespace igraph;
+
+/* Runs the given number of steps of the strategy */
+void runSteps(SimulatedAnnealingStrategy& strategy, Blockmodel* pModel, long numSteps) {
+    for (long i = 0; i < numSteps; i++)
+        strategy.step(pModel);
+}
+
+int test_schedules() {
+    Graph graph = *ring(5) + *ring(5);
+    UndirectedBlockmodel model = Blockmodel::create<UndirectedBlockmodel>(&graph, 2);
+
+    /* The geometric schedule is halfway between the temperatures on a
+     * logarithmic scale after half of the steps */
+    SimulatedAnnealingStrategy geometric(GEOMETRIC_COOLING, 10.0, 0.1, 1000);
+    geometric.getRNG()->init_genrand(42);
+    runSteps(geometric, &model, 500);
+    if (!ALMOST_EQUALS(geometric.getTemperature(), 1.0, 1e-8))
+        return 1;
+    runSteps(geometric, &model, 500);
+    if (!ALMOST_EQUALS(geometric.getTemperature(), 0.1, 1e-8))
+        return 2;
+
+    /* The linear schedule is halfway between them on a linear scale */
+    SimulatedAnnealingStrategy linear(LINEAR_COOLING, 10.0, 0.1, 1000);
+    linear.getRNG()->init_genrand(42);
+    runSteps(linear, &model, 500);
+    if (!ALMOST_EQUALS(linear.getTemperature(), 5.05, 1e-8))
+        return 3;
+    runSteps(linear, &model, 500);
+    if (!ALMOST_EQUALS(linear.getTemperature(), 0.1, 1e-8))
+        return 4;
+
+    /* The adaptive schedule stays between the temperatures */
+    SimulatedAnnealingStrategy adaptive(ADAPTIVE_COOLING, 10.0, 0.1, 1000);
+    adaptive.getRNG()->init_genrand(42);
+    for (int i = 0; i < 1000; i++) {
+        adaptive.step(&model);
+        if (adaptive.getTemperature() < 0.1 || adaptive.getTemperature() > 10.0)
+            return 5;
+    }
+
+    /* Resetting restarts the schedule */
+    geometric.reset();
+    if (geometric.getStepCount() != 0 || geometric.getTemperature() != 10.0)
+        return 6;
+
+    return 0;
+}
+
+int test_quench() {
+    Graph graph = *full(4) + *full(4) + *full(4) + *full(4);
+    Vector types(16);
+
+    /* Connect the cliques into a ring */
+    Vector edges(8);
+    edges[0] =  0; edges[1] =  4; edges[2] =  5; edges[3] =  8;
+    edges[4] =  9; edges[5] = 12; edges[6] = 13; edges[7] =  1;
+    graph.addEdges(edges);
+
+    UndirectedBlockmodel model = Blockmodel::create<UndirectedBlockmodel>(&graph, 4);
+    MersenneTwister rng;
+    rng.init_genrand(42);
+
+    for (int i = 0; i < 16; i++)
+        types[i] = i / 4;
+    model.setTypes(types);
+    double plantedLogL = model.getLogLikelihood();
+
+    for (int schedule = GEOMETRIC_COOLING; schedule <= ADAPTIVE_COOLING; schedule++) {
+        SimulatedAnnealingStrategy strategy(static_cast<CoolingSchedule>(schedule),
+                10.0, 0.01, 20000);
+        strategy.getRNG()->init_genrand(43);
+        model.randomize(rng);
+
+        strategy.optimize(&model);
+        if (!strategy.isFinished() || strategy.getStepCount() != 20000)
+            return 1;
+        if (strategy.step(&model))
+            return 2;
+
+        /* The quench leaves the model in a local optimum */
+        Vector increases(4);
+        for (int i = 0; i < 16; i++) {
+            model.getLogLikelihoodIncreases(i, increases);
+            if (increases.max() > 1e-8)
+                return 3;
+        }
+
+        /* The cliques are found; the adaptive schedule adjusts the
+         * temperature to the acceptance ratio instead of cooling it down
+         * steadily, so it is only required to find a local optimum */
+        if (schedule != ADAPTIVE_COOLING &&
+                model.getLogLikelihood() < plantedLogL - 1e-8) {
+            model.getTypes().print();
+            return 4;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    srand(time(0));
+
+    CHECK(test_schedules);
+    CHECK(test_quench);
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#include <block/block_counts.hpp>
+
+#include "test_common.cpp"
+
+int test_layout() {
+    BlockCounts<int> counts(3, 5);
+
+    if (counts.numRows() != 3 || counts.numCols() != 5)
+        return 1;
+    if (counts.stride() < 5 || (counts.stride() * sizeof(int)) % BlockCounts<int>::ALIGNMENT != 0)
+        return 2;
+
+    for (int i = 0; i < 3; i++) {
+        if (reinterpret_cast<size_t>(counts.row(i)) % BlockCounts<int>::ALIGNMENT != 0)
+            return 3;
+        for (int j = 0; j < counts.stride(); j++)
+            if (counts.row(i)[j] != 0)
+                return 4;
+    }
+
+    counts(1, 2) = 7;
+    if (counts.row(1)[2] != 7 || &counts(1, 2) != counts.row(1) + 2)
+        return 5;
+
+    return 0;
+}
+
+int test_symmetric_updates() {
+    BlockCounts<int> counts(3, 3);
+
+    counts.addSymmetric(0, 2, 3);
+    counts.addSymmetric(1, 1, 1);
+    if (counts(0, 2) != 3 || counts(2, 0) != 3 || counts(1, 1) != 2)
+        return 1;
+    if (counts.rowSum(0) != 3 || counts.rowSum(1) != 2)
+        return 2;
+
+    counts.fill(4);
+    if (counts(2, 2) != 4 || counts.row(2)[counts.stride()-1] != 0)
+        return 3;
+
+    return 0;
+}
+
+int test_copy() {
+    BlockCounts<long> counts(2, 20), copy;
+
+    counts(1, 19) = 42;
+    copy = counts;
+    counts(1, 19) = 0;
+
+    if (copy.numRows() != 2 || copy.numCols() != 20 || copy(1, 19) != 42)
+        return 1;
+    if (reinterpret_cast<size_t>(copy.row(1)) % BlockCounts<long>::ALIGNMENT != 0)
+        return 2;
+
+    BlockCounts<long> copy2(copy);
+    if (copy2(1, 19) != 42)
+        return 3;
+
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    CHECK(test_layout);
+    CHECK(test_symmetric_updates);
+    CHECK(test_copy);
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#include <cmath>
+#include <block/convergence.h>
+#include <mtwister/mt.h>
+
+#include "test_common.cpp"
+
+using namespace igraph;
+
+int test_gelmanRubin() {
+    GelmanRubinConvergenceCriterion criterion(3);
+    MersenneTwister rng;
+    Vector samples;
+
+    rng.init_genrand(42);
+
+    /* Three chains sampling from the same distribution */
+    for (int i = 0; i < 3000; i++)
+        samples.push_back(rng.random());
+    if (!criterion.check(samples))
+        return 1;
+    if (!ALMOST_EQUALS(criterion.getRHat(), 1.0, 0.05))
+        return 2;
+
+    /* Shift the last chain away from the others */
+    for (int i = 2000; i < 3000; i++)
+        samples[i] += 10;
+    criterion.reset();
+    if (criterion.check(samples))
+        return 3;
+    if (criterion.getRHat() < 2)
+        return 4;
+
+    /* Constant chains agreeing with each other */
+    samples.fill(5.0);
+    criterion.reset();
+    if (!criterion.check(samples))
+        return 5;
+
+    /* Constant chains disagreeing with each other */
+    for (int i = 0; i < 1000; i++)
+        samples[i] = 4.0;
+    criterion.reset();
+    if (criterion.check(samples))
+        return 6;
+
+    return 0;
+}
+
+int test_gelmanRubinBurnIn() {
+    GelmanRubinConvergenceCriterion criterion(2);
+    MersenneTwister rng;
+    Vector samples(2000);
+
+    rng.init_genrand(42);
+
+    /* The chains start far from each other... */
+    for (int i = 0; i < 2000; i++)
+        samples[i] = rng.random() + (i < 1000 ? 0 : 10);
+    if (criterion.check(samples))
+        return 1;
+
+    /* ...but they agree afterwards. The first block is the first half of
+     * the two blocks, so it is discarded as burn-in. */
+    for (int i = 0; i < 2000; i++)
+        samples[i] = rng.random();
+    if (!criterion.check(samples))
+        return 2;
+    if (!ALMOST_EQUALS(criterion.getRHat(), 1.0, 0.05))
+        return 3;
+
+    /* The second half of three blocks contains the last two blocks, so
+     * the chains disagree if they drift apart in the third block only */
+    for (int i = 0; i < 2000; i++)
+        samples[i] = rng.random() + (i < 1000 ? 0 : 10);
+    if (criterion.check(samples))
+        return 4;
+
+    return 0;
+}
+
+int test_gelmanRubinKnownValue() {
+    GelmanRubinConvergenceCriterion criterion(2);
+    Vector samples(6);
+
+    /* Chain 1: 1, 2, 3 (mean 2, variance 1)
+     * Chain 2: 3, 4, 5 (mean 4, variance 1)
+     * W = 1, B/n = 2, R = sqrt((2/3 * 1 + 3/2 * 2) / 1) */
+    for (int i = 0; i < 3; i++) {
+        samples[i] = i + 1;
+        samples[i + 3] = i + 3;
+    }
+    criterion.check(samples);
+    if (!ALMOST_EQUALS(criterion.getRHat(), std::sqrt(11.0 / 3), 1e-8))
+        return 1;
+
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    CHECK(test_gelmanRubin);
+    CHECK(test_gelmanRubinKnownValue);
+    CHECK(test_gelmanRubinBurnIn);
+
+    return 0;
+}
@@ -1,9 +1,11 @@
 /* vim:set ts=4 sw=4 sts=4 et: */
 
+#include <algorithm>
 #include <cstdlib>
 #include <block/blockmodel.h>
 #include <igraph/cpp/graph.h>
 #include <igraph/cpp/generators/full.h>
+#include <igraph/cpp/generators/grg.h>
 #include <mtwister/mt.h>
 
 #include "test_common.cpp"
@@ -72,11 +74,110 @@ int test_getLogLikelihoodIncrease() {
     return 0;
 }
 
+int test_getLogLikelihoodIncreases() {
+    /* Disjoint union of two full graphs */
+    Graph graph = *full(5) + *full(3);
+    DegreeCorrectedUndirectedBlockmodel model =
+        Blockmodel::create<DegreeCorrectedUndirectedBlockmodel>(&graph, 4);
+    MersenneTwister rng;
+    Vector increases;
+
+    /* Compare the increases for all the groups with the individual ones */
+    model.randomize(rng);
+    for (int i = 0; i < 1000; i++) {
+        int vertex = rng.randint(8);
+        model.getLogLikelihoodIncreases(vertex, increases);
+        if (increases.size() != 4)
+            return 1;
+
+        for (int j = 0; j < 4; j++) {
+            PointMutation mutation(vertex, model.getType(vertex), j);
+            if (!ALMOST_EQUALS(increases[j],
+                        model.getLogLikelihoodIncrease(mutation), 1e-6))
+                return 2;
+        }
+
+        model.setType(vertex, rng.randint(4));
+    }
+
+    return 0;
+}
+
+int test_getLogLikelihoodTerm() {
+    /* Disjoint union of two full graphs */
+    Graph graph = *full(5) + *full(4);
+    DegreeCorrectedUndirectedBlockmodel model =
+        Blockmodel::create<DegreeCorrectedUndirectedBlockmodel>(&graph, 3);
+    MersenneTwister rng;
+    double offset = 0.0;
+
+    /* The log-likelihood must be the sum of the pairwise terms plus
+     * a constant that depends on the graph only */
+    model.randomize(rng);
+    for (int i = 0; i < 100; i++) {
+        double sum = 0.0;
+        for (int j = 0; j < 3; j++) {
+            for (int k = j; k < 3; k++) {
+                double term = model.getLogLikelihoodTerm(j, k);
+                if (term > 1e-8)
+                    return 1;
+                sum += term;
+            }
+        }
+
+        if (i == 0)
+            offset = model.getLogLikelihood() - sum;
+        else if (!ALMOST_EQUALS(model.getLogLikelihood() - sum, offset, 1e-6))
+            return 2;
+
+        model.setType(rng.randint(9), rng.randint(3));
+    }
+
+    return 0;
+}
+
+int test_mergeTypes() {
+    Graph graph = *grg_game(60, 0.3);
+    DegreeCorrectedUndirectedBlockmodel model =
+        Blockmodel::create<DegreeCorrectedUndirectedBlockmodel>(&graph, 6);
+    MersenneTwister rng;
+
+    /* The predicted increases must match the actual change after merging,
+     * and the merged group must get the smaller index */
+    model.randomize(rng);
+    while (model.getNumTypes() > 1) {
+        int numTypes = model.getNumTypes();
+        int type1 = rng.randint(numTypes), type2 = rng.randint(numTypes);
+        if (type1 == type2)
+            continue;
+
+        long mergedCount = model.getTypeCount(type1) + model.getTypeCount(type2);
+        double predictedLogL = model.getLogLikelihood() +
+            model.getMergeLogLikelihoodIncrease(type1, type2);
+        model.mergeTypes(type1, type2);
+
+        if (model.getNumTypes() != numTypes - 1)
+            return 1;
+        if (model.getTypeCount(std::min(type1, type2)) != mergedCount)
+            return 2;
+        if (!ALMOST_EQUALS(model.getLogLikelihood(), predictedLogL, 1e-6))
+            return 3;
+        if (!ALMOST_EQUALS(model.getLogLikelihood(),
+                    model.recalculateLogLikelihood(), 1e-6))
+            return 4;
+    }
+
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     srand(time(0));
 
     CHECK(test_getLogLikelihood);
     CHECK(test_getLogLikelihoodIncrease);
+    CHECK(test_getLogLikelihoodIncreases);
+    CHECK(test_getLogLikelihoodTerm);
+    CHECK(test_mergeTypes);
 
     return 0;
 }
@@ -0,0 +1,74 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#include <cstdlib>
+#include <vector>
+#include <block/math.hpp>
+#include <mtwister/mt.h>
+
+#include "test_common.cpp"
+
+int test_prefix_sums() {
+    FenwickTree<double> tree;
+    MersenneTwister rng;
+    std::vector<double> values(37);
+
+    for (size_t i = 0; i < values.size(); i++)
+        values[i] = rng.randint(10);
+    tree.assign(values);
+
+    for (int round = 0; round < 2; round++) {
+        double sum = 0.0;
+        for (long i = 0; i <= tree.size(); i++) {
+            if (!ALMOST_EQUALS(tree.prefixSum(i), sum, 1e-8))
+                return 1;
+            if (i < tree.size())
+                sum += values[i];
+        }
+        if (!ALMOST_EQUALS(tree.total(), sum, 1e-8))
+            return 2;
+
+        /* Change some of the weights and check again */
+        for (int j = 0; j < 20; j++) {
+            long index = rng.randint(values.size());
+            values[index] = rng.randint(10);
+            tree.set(index, values[index]);
+            if (tree.get(index) != values[index])
+                return 3;
+        }
+    }
+
+    return 0;
+}
+
+int test_find() {
+    FenwickTree<double> tree;
+    std::vector<double> values(10, 0.0);
+
+    values[2] = 1.0; values[3] = 2.0; values[7] = 0.5;
+    tree.assign(values);
+
+    if (tree.find(0.0) != 2 || tree.find(0.99) != 2)
+        return 1;
+    if (tree.find(1.0) != 3 || tree.find(2.99) != 3)
+        return 2;
+    if (tree.find(3.0) != 7 || tree.find(3.49) != 7)
+        return 3;
+
+    /* Values beyond the total weight give the last element */
+    if (tree.find(3.5) != 9)
+        return 4;
+
+    /* Zero weights are skipped after a change */
+    tree.set(3, 0.0);
+    if (tree.find(1.0) != 7)
+        return 5;
+
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    CHECK(test_prefix_sums);
+    CHECK(test_find);
+
+    return 0;
+}
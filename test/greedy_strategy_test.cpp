@@ -1,5 +1,6 @@
 /* vim:set ts=4 sw=4 sts=4 et: */
 
+#include <cmath>
 #include <cstdlib>
 #include <igraph/cpp/edge_selector.h>
 #include <igraph/cpp/graph.h>
@@ -45,15 +46,17 @@ int test_four_almost_cliques() {
     GreedyStrategy<UndirectedBlockmodel> greedy;
     UndirectedBlockmodel model;
 
-    model.setGraph(&graph);
-    model.setNumTypes(4);
-
     /* Remove one edge from each clique */
     Vector edges(8);
     edges[0] =  0; edges[1] =  1; edges[2] =  5; edges[3] =  6;
     edges[4] = 10; edges[5] = 11; edges[6] = 15; edges[7] = 12;
     graph.deleteEdges(EdgeSelector::Pairs(edges));
 
+    /* The model caches the adjacency lists, so we attach the graph only
+     * after it has been modified */
+    model.setGraph(&graph);
+    model.setNumTypes(4);
+
     /* Every clique is colored differently */
     for (int i = 0; i < 16; i++)
         types[i] = i / 4;
@@ -79,6 +82,165 @@ int test_four_almost_cliques() {
     return 0;
 }
 
+int test_impossible_pairs() {
+    Graph graph = *full(5) + *full(5) + *full(5);
+    Vector types(15);
+    GreedyStrategy<UndirectedBlockmodel> greedy;
+    UndirectedBlockmodel model;
+
+    /* Remove one edge from each clique, so no probability is 1 */
+    Vector edges(6);
+    edges[0] = 0; edges[1] = 1; edges[2] = 5; edges[3] = 6;
+    edges[4] = 10; edges[5] = 11;
+    graph.deleteEdges(EdgeSelector::Pairs(edges));
+
+    model.setGraph(&graph);
+    model.setNumTypes(3);
+    for (int i = 0; i < 15; i++)
+        types[i] = i / 5;
+    model.setTypes(types);
+
+    /* The probabilities between different groups are zero here, so
+     * log(P) - log(1-P) has infinite elements. The vertices have no
+     * neighbors in the other groups, so their scores must stay finite
+     * and every vertex must stay in its own group. */
+    if (greedy.step(&model))
+        return 1;
+    if (model.getTypes() != types)
+        return 2;
+    if (!(model.getLogLikelihood() > -HUGE_VAL))
+        return 3;
+
+    return 0;
+}
+
+int test_worklist(bool asynchronous) {
+    Graph graph = *ring(5) + *ring(5);
+    Vector types(10);
+    WorklistGreedyStrategy<UndirectedBlockmodel> greedy(asynchronous);
+    UndirectedBlockmodel model;
+    model.setGraph(&graph);
+    model.setNumTypes(2);
+
+    /* Set up the optimal configuration and see if we stay there */
+    for (int i = 0; i < 10; i++)
+        types[i] = i/5;
+    model.setTypes(types);
+
+    greedy.optimize(&model);
+    if (model.getTypes() != types)
+        return 1;
+
+    /* Change one element and see if we converge back */
+    model.setType(0, 1);
+    greedy.reset();
+    greedy.optimize(&model);
+    if (model.getTypes() != types)
+        return 2;
+
+    return 0;
+}
+
+int test_worklist_synchronous() {
+    return test_worklist(false);
+}
+
+int test_worklist_asynchronous() {
+    return test_worklist(true);
+}
+
+int test_worklist_local_optimum() {
+    Graph graph = *grg_game(200, 0.15);
+    WorklistGreedyStrategy<UndirectedBlockmodel> greedy;
+    MersenneTwister rng;
+    UndirectedBlockmodel model;
+    Vector increases;
+
+    model.setGraph(&graph);
+    model.setNumTypes(5);
+    model.randomize(rng);
+
+    double logL = model.getLogLikelihood();
+    greedy.optimize(&model);
+    if (model.getLogLikelihood() < logL)
+        return 1;
+
+    /* No single vertex move may improve the log-likelihood any more */
+    for (int i = 0; i < graph.vcount(); i++) {
+        model.getLogLikelihoodIncreases(i, increases);
+        for (int j = 0; j < model.getNumTypes(); j++)
+            if (increases[j] > 1e-6)
+                return 2;
+    }
+
+    return 0;
+}
+
+int test_kernighan_lin() {
+    Graph graph = *grg_game(200, 0.15);
+    KernighanLinStrategy<UndirectedBlockmodel> refinement(50);
+    MersenneTwister rng;
+    UndirectedBlockmodel model;
+    Vector increases;
+
+    model.setGraph(&graph);
+    model.setNumTypes(5);
+    model.randomize(rng);
+
+    /* Every pass must increase the log-likelihood or keep the state */
+    double logL = model.getLogLikelihood();
+    Vector types = model.getTypes();
+    while (refinement.step(&model)) {
+        if (model.getLogLikelihood() <= logL)
+            return 1;
+        logL = model.getLogLikelihood();
+        types = model.getTypes();
+    }
+    if (model.getTypes() != types)
+        return 2;
+    if (!ALMOST_EQUALS(model.getLogLikelihood(), model.recalculateLogLikelihood(), 1e-6))
+        return 3;
+
+    /* The final state is a local optimum for single moves as well */
+    for (int i = 0; i < graph.vcount(); i++) {
+        model.getLogLikelihoodIncreases(i, increases);
+        for (int j = 0; j < model.getNumTypes(); j++)
+            if (increases[j] > 1e-6)
+                return 4;
+    }
+
+    return 0;
+}
+
+int test_split_group() {
+    Graph graph = *full(6) + *full(6) + *full(6);
+    MersenneTwister rng;
+    UndirectedBlockmodel model;
+
+    model.setGraph(&graph);
+    model.setNumTypes(2);
+
+    /* The first two cliques are merged in group 0 */
+    for (int i = 0; i < 18; i++)
+        model.setType(i, i < 12 ? 0 : 1);
+    if (findWorstGroup(&model) != 0)
+        return 1;
+
+    /* Splitting group 0 must separate the first two cliques */
+    model.setNumTypes(3);
+    bisectGroup(&model, 0, 2, rng);
+    for (int i = 0; i < 18; i++) {
+        if (model.getType(i) != model.getType(i / 6 * 6))
+            return 2;
+    }
+    if (model.getType(0) == model.getType(6) || model.getType(12) != 1)
+        return 3;
+    if (!ALMOST_EQUALS(model.getLogLikelihood(), 0.0, 1e-8))
+        return 4;
+
+    return 0;
+}
+
 /* This test is skipped currently as the greedy strategy uses an *approximation*
  * only, which prevents it from finding an exact match */
 int test_grg() {
@@ -135,6 +297,12 @@ int main(int argc, char* argv[]) {
 
     CHECK(test_two_rings);
     CHECK(test_four_almost_cliques);
+    CHECK(test_impossible_pairs);
+    CHECK(test_worklist_synchronous);
+    CHECK(test_worklist_asynchronous);
+    CHECK(test_worklist_local_optimum);
+    CHECK(test_kernighan_lin);
+    CHECK(test_split_group);
     // CHECK(test_grg);
 
     return 0;
@@ -0,0 +1,122 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <igraph/cpp/graph.h>
+#include <igraph/cpp/generators/full.h>
+#include <block/blockmodel.h>
+#include <block/merging.h>
+#include <mtwister/mt.h>
+
+#include "test_common.cpp"
+
+using namespace igraph;
+
+int test_merge_cliques() {
+    /* Disjoint union of three full graphs, each split into two groups */
+    Graph graph = *full(6) + *full(6) + *full(6);
+    UndirectedBlockmodel model =
+        Blockmodel::create<UndirectedBlockmodel>(&graph, 6);
+    GroupMerger merger;
+
+    for (int i = 0; i < 18; i++)
+        model.setType(i, i / 3);
+    merger.initialize(&model);
+
+    /* Merging the halves of the cliques does not lose anything */
+    for (int i = 0; i < 3; i++) {
+        double increase = merger.mergeCheapestPair(&model);
+        if (!ALMOST_EQUALS(increase, 0.0, 1e-8))
+            return 1;
+    }
+    if (model.getNumTypes() != 3)
+        return 2;
+    if (!ALMOST_EQUALS(model.getLogLikelihood(), 0.0, 1e-8))
+        return 3;
+    for (int i = 0; i < 18; i++) {
+        if (model.getType(i) != model.getType(i - i % 6))
+            return 4;
+    }
+
+    /* Merging two cliques does */
+    if (merger.mergeCheapestPair(&model) >= 0)
+        return 5;
+    if (model.getNumTypes() != 2)
+        return 6;
+
+    return 0;
+}
+
+int test_modified_model() {
+    /* Disjoint union of three full graphs, each split into two groups */
+    Graph graph = *full(6) + *full(6) + *full(6);
+    DegreeCorrectedUndirectedBlockmodel model =
+        Blockmodel::create<DegreeCorrectedUndirectedBlockmodel>(&graph, 6);
+    GroupMerger merger;
+    MersenneTwister rng;
+
+    rng.init_genrand(42);
+    model.randomize(rng);
+    merger.initialize(&model);
+
+    /* The model is modified between the merges; the increases reported by
+     * the merger must still match the actual changes */
+    while (model.getNumTypes() > 1) {
+        for (int i = 0; i < 5; i++)
+            model.setType(rng.randint(18), rng.randint(model.getNumTypes()));
+
+        double logL = model.getLogLikelihood();
+        double increase = merger.mergeCheapestPair(&model);
+        if (!ALMOST_EQUALS(model.getLogLikelihood(), logL + increase, 1e-6))
+            return 1;
+    }
+
+    /* Nothing left to merge */
+    try {
+        merger.mergeCheapestPair(&model);
+        return 2;
+    } catch (const std::invalid_argument&) {
+    }
+
+    return 0;
+}
+
+int test_cheapest_pair() {
+    /* Disjoint union of three full graphs, each split into two groups */
+    Graph graph = *full(6) + *full(6) + *full(6);
+    UndirectedBlockmodel model =
+        Blockmodel::create<UndirectedBlockmodel>(&graph, 6);
+    GroupMerger merger;
+    MersenneTwister rng;
+
+    rng.init_genrand(42);
+    model.randomize(rng);
+    merger.initialize(&model);
+
+    /* Every merge must be the cheapest one in the current model, not only
+     * among the pairs affected by the previous merge */
+    while (model.getNumTypes() > 1) {
+        double bestIncrease = -std::numeric_limits<double>::infinity();
+        for (int i = 0; i < model.getNumTypes(); i++)
+            for (int j = i+1; j < model.getNumTypes(); j++)
+                bestIncrease = std::max(bestIncrease,
+                        model.getMergeLogLikelihoodIncrease(i, j));
+
+        if (!ALMOST_EQUALS(merger.mergeCheapestPair(&model), bestIncrease, 1e-8))
+            return 1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    srand(time(0));
+
+    CHECK(test_merge_cliques);
+    CHECK(test_modified_model);
+    CHECK(test_cheapest_pair);
+
+    return 0;
+}
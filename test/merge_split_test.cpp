@@ -0,0 +1,163 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <igraph/cpp/graph.h>
+#include <igraph/cpp/generators/full.h>
+#include <block/blockmodel.h>
+#include <block/optimization.hpp>
+#include <mtwister/mt.h>
+
+#include "test_common.cpp"
+
+/* The tolerance of the observed probabilities; the standard error is
+ * below 0.002 with the number of steps of the tests */
+#define TOLERANCE 0.01
+
+using namespace igraph;
+
+/* Calculates the stationary distribution of the number of groups by
+ * enumerating the set partitions of the vertices as restricted growth
+ * strings */
+template <typename T>
+std::vector<double> exactGroupCountDistribution(Graph* pGraph,
+        const MergeSplitStrategy& strategy) {
+    long n = pGraph->vcount();
+    std::vector<int> types(n, 0);
+    std::vector<double> result(n + 1, 0.0);
+    double sum = 0.0;
+
+    while (true) {
+        int numTypes = *std::max_element(types.begin(), types.end()) + 1;
+        T model = Blockmodel::create<T>(pGraph, numTypes);
+        Vector typeVector(n);
+        for (long i = 0; i < n; i++)
+            typeVector[i] = types[i];
+        model.setTypes(typeVector);
+
+        double p = std::exp(model.getLogLikelihood() +
+                strategy.getLogPrior(numTypes));
+        result[numTypes] += p;
+        sum += p;
+
+        /* Next restricted growth string */
+        long i = n - 1;
+        while (i > 0 && types[i] > *std::max_element(types.begin(),
+                    types.begin() + i))
+            i--;
+        if (i == 0)
+            break;
+        types[i]++;
+        std::fill(types.begin() + i + 1, types.end(), 0);
+    }
+
+    for (long k = 0; k <= n; k++)
+        result[k] /= sum;
+    return result;
+}
+
+/* Runs the merge-split chain on two triangles and compares the observed
+ * distribution of the number of groups with the exact one. If
+ * numPointMoves is positive, the given number of Metropolis-Hastings
+ * steps is interleaved with every merge-split step */
+template <typename T>
+int checkStationaryDistribution(int numPointMoves) {
+    /* Two triangles; small enough to enumerate all the partitions */
+    Graph graph = *full(3) + *full(3);
+    T model = Blockmodel::create<T>(&graph, 1);
+    MergeSplitStrategy strategy(0.5);
+    MetropolisHastingsStrategy mcmc;
+    std::vector<double> expected =
+        exactGroupCountDistribution<T>(&graph, strategy);
+    std::vector<double> observed(7, 0.0);
+    const long numSteps = 1000000;
+
+    strategy.getRNG()->init_genrand(42);
+    mcmc.getRNG()->init_genrand(43);
+    mcmc.setKeepGroupsNonEmpty(true);
+
+    for (long i = 0; i < numSteps; i++) {
+        strategy.step(&model);
+        for (int j = 0; j < numPointMoves; j++)
+            mcmc.step(&model);
+        observed[model.getNumTypes()] += 1.0 / numSteps;
+
+        for (int type = 0; type < model.getNumTypes(); type++) {
+            if (model.getTypeCount(type) == 0)
+                return 3;
+        }
+        if (!ALMOST_EQUALS(model.getLogLikelihood(),
+                    model.recalculateLogLikelihood(), 1e-6))
+            return 1;
+    }
+
+    for (int k = 1; k <= 6; k++) {
+        if (!ALMOST_EQUALS(observed[k], expected[k], TOLERANCE)) {
+            std::cout << "k = " << k << ": expected " << expected[k]
+                      << ", observed " << observed[k] << '\n';
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+int test_stationary_distribution() {
+    return checkStationaryDistribution<UndirectedBlockmodel>(0);
+}
+
+int test_stationary_distribution_dc() {
+    return checkStationaryDistribution<DegreeCorrectedUndirectedBlockmodel>(0);
+}
+
+int test_stationary_distribution_interleaved() {
+    return checkStationaryDistribution<UndirectedBlockmodel>(3);
+}
+
+int test_stationary_distribution_interleaved_dc() {
+    return checkStationaryDistribution<DegreeCorrectedUndirectedBlockmodel>(3);
+}
+
+int test_find_cliques() {
+    /* Disjoint union of three full graphs, starting from a single group.
+     * Splitting a clique does not change the log-likelihood, so a strong
+     * penalty is needed to make the three cliques the dominant state */
+    Graph graph = *full(8) + *full(8) + *full(8);
+    UndirectedBlockmodel model =
+        Blockmodel::create<UndirectedBlockmodel>(&graph, 1);
+    MergeSplitStrategy mergeSplit(10.0);
+    MetropolisHastingsStrategy mcmc;
+
+    mergeSplit.getRNG()->init_genrand(42);
+    mcmc.getRNG()->init_genrand(43);
+    mcmc.setKeepGroupsNonEmpty(true);
+
+    for (int i = 0; i < 20000; i++) {
+        mcmc.step(&model);
+        if (i % 10 == 0)
+            mergeSplit.step(&model);
+    }
+
+    if (model.getNumTypes() != 3)
+        return 1;
+    if (!ALMOST_EQUALS(model.getLogLikelihood(), 0.0, 1e-8))
+        return 2;
+    if (mergeSplit.getStepCount() != 2000)
+        return 3;
+
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    srand(time(0));
+
+    CHECK(test_stationary_distribution);
+    CHECK(test_stationary_distribution_dc);
+    CHECK(test_stationary_distribution_interleaved);
+    CHECK(test_stationary_distribution_interleaved_dc);
+    CHECK(test_find_cliques);
+
+    return 0;
+}
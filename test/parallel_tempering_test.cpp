@@ -0,0 +1,96 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#include <cstdlib>
+#include <igraph/cpp/graph.h>
+#include <igraph/cpp/generators/full.h>
+#include <igraph/cpp/generators/grg.h>
+#include <block/blockmodel.h>
+#include <block/tempering.h>
+
+#include "test_common.cpp"
+
+using namespace igraph;
+
+int test_ladder() {
+    Graph graph = *grg_game(50, 0.2);
+    UndirectedBlockmodel model =
+        Blockmodel::create<UndirectedBlockmodel>(&graph, 3);
+    ParallelTempering tempering;
+    MersenneTwister rng;
+
+    model.randomize(rng);
+    tempering.initialize(&model, 4, 1.0, 8.0, rng);
+
+    if (tempering.getNumReplicas() != 4)
+        return 1;
+    if (!ALMOST_EQUALS(tempering.getTemperature(0), 1.0, 1e-8) ||
+        !ALMOST_EQUALS(tempering.getTemperature(1), 2.0, 1e-8) ||
+        !ALMOST_EQUALS(tempering.getTemperature(2), 4.0, 1e-8) ||
+        !ALMOST_EQUALS(tempering.getTemperature(3), 8.0, 1e-8))
+        return 2;
+    if (!ALMOST_EQUALS(tempering.getSampler(3)->getInverseTemperature(),
+                0.125, 1e-8))
+        return 3;
+
+    return 0;
+}
+
+int test_best_state() {
+    /* Disjoint union of two full graphs */
+    Graph graph = *full(10) + *full(10);
+    UndirectedBlockmodel model =
+        Blockmodel::create<UndirectedBlockmodel>(&graph, 2);
+    ParallelTempering tempering;
+    MersenneTwister rng;
+    Vector samples;
+
+    model.randomize(rng);
+    tempering.initialize(&model, 3, 1.0, 5.0, rng);
+
+    double bestLogL = tempering.getBestLogLikelihood();
+    for (int i = 0; i < 50; i++) {
+        tempering.runRound(100, &samples);
+
+        /* The best log-likelihood may only increase and it must belong
+         * to the best model */
+        if (tempering.getBestLogLikelihood() < bestLogL)
+            return 1;
+        bestLogL = tempering.getBestLogLikelihood();
+        if (!ALMOST_EQUALS(bestLogL,
+                    tempering.getBestModel()->getLogLikelihood(), 1e-6))
+            return 2;
+
+        /* No replica may be better than the best model */
+        for (int j = 0; j < tempering.getNumReplicas(); j++) {
+            if (tempering.getReplica(j)->getLogLikelihood() > bestLogL + 1e-6)
+                return 3;
+        }
+    }
+
+    /* Only the samples of the coldest replica are collected */
+    if (samples.size() != 50 * 100)
+        return 4;
+    if (samples.max() > bestLogL + 1e-6)
+        return 5;
+
+    /* The two cliques must have been found */
+    if (!ALMOST_EQUALS(bestLogL, 0.0, 1e-6))
+        return 6;
+
+    for (int i = 0; i + 1 < tempering.getNumReplicas(); i++) {
+        double rate = tempering.getSwapAcceptanceRate(i);
+        if (rate < 0 || rate > 1)
+            return 7;
+    }
+
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    srand(time(0));
+
+    CHECK(test_ladder);
+    CHECK(test_best_state);
+
+    return 0;
+}
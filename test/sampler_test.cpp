@@ -0,0 +1,343 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <igraph/cpp/graph.h>
+#include <igraph/cpp/generators/full.h>
+#include <block/blockmodel.h>
+#include <block/optimization.hpp>
+#include <mtwister/mt.h>
+
+#include "test_common.cpp"
+
+using namespace igraph;
+
+/* Two triangles connected by an edge and an isolated vertex */
+Graph createTestGraph() {
+    Graph graph(7);
+    Vector edges;
+    int pairs[] = { 0,1, 0,2, 1,2, 3,4, 3,5, 4,5, 2,3 };
+
+    for (int i = 0; i < 14; i++)
+        edges.push_back(pairs[i]);
+    graph.addEdges(edges);
+    return graph;
+}
+
+/* Expected value of the log-likelihood and the probability that vertices
+ * 0 and 5 are in the same group, calculated by enumerating all the
+ * configurations with the given number of groups */
+template <typename T>
+void calculateExactStatistics(Graph* pGraph, int numTypes,
+        double& meanLogL, double& sameGroupProb) {
+    long n = pGraph->vcount();
+    T model = Blockmodel::create<T>(pGraph, numTypes);
+    Vector types(n);
+    double sum = 0.0;
+
+    meanLogL = sameGroupProb = 0.0;
+    while (true) {
+        model.setTypes(types);
+
+        double logL = model.getLogLikelihood();
+        double p = std::exp(logL);
+        sum += p;
+        meanLogL += p * logL;
+        if (types[0] == types[5])
+            sameGroupProb += p;
+
+        long i = 0;
+        while (i < n && types[i] == numTypes - 1)
+            types[i++] = 0;
+        if (i == n)
+            break;
+        types[i]++;
+    }
+
+    meanLogL /= sum;
+    sameGroupProb /= sum;
+}
+
+/* Runs the given strategy and compares the statistics of the samples to
+ * the exact values. With sweeps, the samples are taken after every sweep.
+ * The number of samples must keep the standard errors below a quarter of
+ * the tolerances */
+template <typename T, typename Strategy>
+int checkStationaryDistribution(Strategy& strategy, bool useSweeps = false,
+        long numSamples = 400000) {
+    Graph graph = createTestGraph();
+    T model = Blockmodel::create<T>(&graph, 3);
+    double meanLogL, sameGroupProb;
+    double observedMeanLogL = 0.0, observedSameGroupProb = 0.0;
+
+    calculateExactStatistics<T>(&graph, 3, meanLogL, sameGroupProb);
+    strategy.getRNG()->init_genrand(42);
+
+    for (long i = 0; i < numSamples; i++) {
+        if (useSweeps)
+            strategy.sweep(&model);
+        else
+            strategy.step(&model);
+        observedMeanLogL += model.getLogLikelihood() / numSamples;
+        if (model.getType(0) == model.getType(5))
+            observedSameGroupProb += 1.0 / numSamples;
+    }
+
+    if (!ALMOST_EQUALS(model.getLogLikelihood(),
+                model.recalculateLogLikelihood(), 1e-6))
+        return 1;
+    if (!ALMOST_EQUALS(observedMeanLogL, meanLogL, 0.05)) {
+        std::cout << "mean log-likelihood: expected " << meanLogL
+                  << ", observed " << observedMeanLogL << '\n';
+        return 2;
+    }
+    if (!ALMOST_EQUALS(observedSameGroupProb, sameGroupProb, 0.01)) {
+        std::cout << "co-membership probability: expected " << sameGroupProb
+                  << ", observed " << observedSameGroupProb << '\n';
+        return 3;
+    }
+
+    return 0;
+}
+
+int test_metropolis_hastings() {
+    MetropolisHastingsStrategy strategy;
+    return checkStationaryDistribution<UndirectedBlockmodel>(strategy, false, 1600000);
+}
+
+int test_neighbor_proposal() {
+    MetropolisHastingsStrategy strategy;
+    strategy.setProposalDistribution(NEIGHBOR_PROPOSAL);
+    strategy.setEpsilon(0.5);
+    /* The chain mixes slowly with a small epsilon, so it needs more samples */
+    return checkStationaryDistribution<UndirectedBlockmodel>(strategy, false, 4000000);
+}
+
+int test_neighbor_proposal_dc() {
+    MetropolisHastingsStrategy strategy;
+    strategy.setProposalDistribution(NEIGHBOR_PROPOSAL);
+    return checkStationaryDistribution<DegreeCorrectedUndirectedBlockmodel>(strategy, false, 1600000);
+}
+
+int test_sweep_order() {
+    SweepOrder order(16);
+    MersenneTwister rng;
+    std::vector<int> visits(100);
+
+    rng.init_genrand(42);
+    /* Every vertex is visited exactly once in every sweep */
+    for (int sweep = 1; sweep <= 3; sweep++) {
+        order.shuffle(100, rng);
+        if (order.getNumBlocks() != 7)
+            return 1;
+        for (long b = 0; b < order.getNumBlocks(); b++) {
+            if (order.getBlockStart(b) % 16 != 0)
+                return 2;
+            for (long i = order.getBlockStart(b); i < order.getBlockEnd(b); i++)
+                visits[i]++;
+        }
+        for (int i = 0; i < 100; i++)
+            if (visits[i] != sweep)
+                return 3;
+    }
+
+    return 0;
+}
+
+int test_sweep_blocks() {
+    /* A sweep done block by block is the same as a single sweep; the
+     * graph has more than one block of vertices */
+    Graph graph = *full(200) + *full(200);
+    UndirectedBlockmodel model1 = Blockmodel::create<UndirectedBlockmodel>(&graph, 3);
+    UndirectedBlockmodel model2 = Blockmodel::create<UndirectedBlockmodel>(&graph, 3);
+    MetropolisHastingsStrategy strategy1, strategy2;
+
+    strategy1.getRNG()->init_genrand(42);
+    strategy2.getRNG()->init_genrand(42);
+    for (int sweep = 0; sweep < 10; sweep++) {
+        strategy1.sweep(&model1);
+
+        long numBlocks = strategy2.startSweep(&model2);
+        for (long b = 0; b < numBlocks; b++)
+            strategy2.sweepBlock(&model2, b);
+    }
+
+    for (int i = 0; i < 400; i++) {
+        if (model1.getType(i) != model2.getType(i))
+            return 1;
+    }
+    if (strategy2.getStepCount() != 4000)
+        return 2;
+
+    return 0;
+}
+
+int test_metropolis_hastings_sweeps() {
+    MetropolisHastingsStrategy strategy;
+    return checkStationaryDistribution<UndirectedBlockmodel>(strategy, true);
+}
+
+int test_neighbor_proposal_sweeps() {
+    MetropolisHastingsStrategy strategy;
+    strategy.setProposalDistribution(NEIGHBOR_PROPOSAL);
+    return checkStationaryDistribution<DegreeCorrectedUndirectedBlockmodel>(strategy, true);
+}
+
+int test_gibbs() {
+    GibbsSamplingStrategy strategy;
+    if (checkStationaryDistribution<UndirectedBlockmodel>(strategy, false, 1600000))
+        return 1;
+    if (strategy.getAcceptanceRatio() <= 0 || strategy.getAcceptanceRatio() >= 1)
+        return 2;
+    return 0;
+}
+
+int test_gibbs_large_increases() {
+    /* Moving a vertex of one clique to the group of the other decreases
+     * the log-likelihood by about 800 while moving it to the empty group
+     * does not change it, so exp() would overflow without shifting the
+     * increases by their maximum */
+    Graph graph = *full(80) + *full(80);
+    UndirectedBlockmodel model = Blockmodel::create<UndirectedBlockmodel>(&graph, 3);
+    GibbsSamplingStrategy strategy;
+    Vector types(160);
+
+    strategy.getRNG()->init_genrand(42);
+    for (int i = 0; i < 160; i++)
+        types[i] = i / 80;
+    model.setTypes(types);
+
+    for (int i = 0; i < 10000; i++)
+        strategy.step(&model);
+
+    /* The vertices move to the empty group but the cliques never mix */
+    if (strategy.getAcceptanceRatio() == 0)
+        return 1;
+    for (int i = 0; i < 80; i++) {
+        for (int j = 80; j < 160; j++) {
+            if (model.getType(i) == model.getType(j))
+                return 2;
+        }
+    }
+
+    return 0;
+}
+
+int test_gibbs_sweeps() {
+    GibbsSamplingStrategy strategy;
+    if (checkStationaryDistribution<UndirectedBlockmodel>(strategy, true))
+        return 1;
+    if (strategy.getStepCount() != 7 * 400000)
+        return 2;
+    return 0;
+}
+
+/* The rejection-free strategy samples every state for the number of
+ * Metropolis-Hastings steps it would have been observed for, so the
+ * samples are weighted by the waiting times. The tolerances can be given
+ * for the approximate configurations */
+template <typename T>
+int checkRejectionFree(RejectionFreeStrategy& strategy,
+        double logLTolerance = 0.05, double probTolerance = 0.01) {
+    Graph graph = createTestGraph();
+    T model = Blockmodel::create<T>(&graph, 3);
+    double meanLogL, sameGroupProb;
+    double observedMeanLogL = 0.0, observedSameGroupProb = 0.0;
+    const long numSamples = 400000;
+
+    calculateExactStatistics<T>(&graph, 3, meanLogL, sameGroupProb);
+    strategy.getRNG()->init_genrand(42);
+
+    for (long i = 0; i < numSamples; i++) {
+        double logL = model.getLogLikelihood();
+        bool sameGroup = (model.getType(0) == model.getType(5));
+
+        strategy.step(&model);
+
+        double weight = strategy.getLastWaitingTime() - 1;
+        observedMeanLogL += weight * logL + model.getLogLikelihood();
+        observedSameGroupProb += weight * sameGroup +
+            (model.getType(0) == model.getType(5));
+    }
+    observedMeanLogL /= strategy.getEquivalentStepCount();
+    observedSameGroupProb /= strategy.getEquivalentStepCount();
+
+    if (strategy.getEquivalentStepCount() < numSamples)
+        return 1;
+    if (!ALMOST_EQUALS(model.getLogLikelihood(),
+                model.recalculateLogLikelihood(), 1e-6))
+        return 2;
+    if (!ALMOST_EQUALS(observedMeanLogL, meanLogL, logLTolerance)) {
+        std::cout << "mean log-likelihood: expected " << meanLogL
+                  << ", observed " << observedMeanLogL << '\n';
+        return 3;
+    }
+    if (!ALMOST_EQUALS(observedSameGroupProb, sameGroupProb, probTolerance)) {
+        std::cout << "co-membership probability: expected " << sameGroupProb
+                  << ", observed " << observedSameGroupProb << '\n';
+        return 4;
+    }
+
+    return 0;
+}
+
+int test_rejection_free() {
+    /* Re-evaluating every vertex after every move keeps the bounds valid */
+    RejectionFreeStrategy strategy(1.0, 1);
+    if (checkRejectionFree<UndirectedBlockmodel>(strategy))
+        return 1;
+    if (strategy.getNumBoundViolations() != 0)
+        return 2;
+    if (strategy.getAcceptanceRatio() <= 0 || strategy.getAcceptanceRatio() >= 1)
+        return 3;
+    return 0;
+}
+
+int test_rejection_free_dc() {
+    RejectionFreeStrategy strategy(1.0, 1);
+    return checkRejectionFree<DegreeCorrectedUndirectedBlockmodel>(strategy);
+}
+
+/* With the default refresh period, the bounds go stale between the
+ * re-evaluations, and the small test graph makes the bias of the mean
+ * log-likelihood about 0.1. The tolerances only check that the sampler
+ * stays close, and the violations must be reported */
+int test_rejection_free_default() {
+    RejectionFreeStrategy strategy;
+    if (checkRejectionFree<UndirectedBlockmodel>(strategy, 0.2, 0.01))
+        return 1;
+    if (strategy.getNumBoundViolations() == 0)
+        return 2;
+    return 0;
+}
+
+int test_rejection_free_default_dc() {
+    RejectionFreeStrategy strategy;
+    if (checkRejectionFree<DegreeCorrectedUndirectedBlockmodel>(strategy, 0.2, 0.01))
+        return 1;
+    if (strategy.getNumBoundViolations() == 0)
+        return 2;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    srand(time(0));
+
+    CHECK(test_metropolis_hastings);
+    CHECK(test_neighbor_proposal);
+    CHECK(test_neighbor_proposal_dc);
+    CHECK(test_sweep_order);
+    CHECK(test_sweep_blocks);
+    CHECK(test_metropolis_hastings_sweeps);
+    CHECK(test_neighbor_proposal_sweeps);
+    CHECK(test_gibbs);
+    CHECK(test_gibbs_large_increases);
+    CHECK(test_gibbs_sweeps);
+    CHECK(test_rejection_free);
+    CHECK(test_rejection_free_dc);
+    CHECK(test_rejection_free_default);
+    CHECK(test_rejection_free_default_dc);
+
+    return 0;
+}
@@ -1,6 +1,7 @@
 /* vim:set ts=4 sw=4 sts=4 et: */
 
 #include <cstdlib>
+#include <memory>
 #include <block/blockmodel.h>
 #include <igraph/cpp/graph.h>
 #include <igraph/cpp/generators/full.h>
@@ -210,6 +211,291 @@ int test_getLogLikelihoodIncrease() {
     return 0;
 }
 
+int test_incrementalLogLikelihood() {
+    Graph graph = *grg_game(100, 0.2);
+    UndirectedBlockmodel model = Blockmodel::create<UndirectedBlockmodel>(&graph, 5);
+    MersenneTwister rng;
+    double logL;
+
+    /* Make sure that the log-likelihood terms are calculated */
+    model.randomize(rng);
+    model.getLogLikelihood();
+
+    /* Do many random mutations and compare the incrementally updated
+     * log-likelihood with the re-calculated one every now and then */
+    for (int i = 0; i < 10000; i++) {
+        int from = rng.randint(100);
+        PointMutation mutation(from, model.getType(from), rng.randint(5));
+        model.performMutation(mutation);
+
+        if (i % 100 != 99)
+            continue;
+
+        logL = model.getLogLikelihood();
+        if (!ALMOST_EQUALS(logL, model.recalculateLogLikelihood(), 1e-6)) {
+            std::cout << "Step #" << (i+1) << '\n'
+                      << "Incremental logL = " << logL << '\n'
+                      << "Actual logL      = " << model.getLogLikelihood() << '\n';
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int test_getLogLikelihoodIncreases() {
+    /* Disjoint union of two full graphs */
+    Graph graph = *full(5) + *full(5);
+    UndirectedBlockmodel model =
+        Blockmodel::create<UndirectedBlockmodel>(&graph, 5);
+    MersenneTwister rng;
+    Vector increases;
+
+    /* Compare the increases for all the groups with the individual ones */
+    model.randomize(rng);
+    for (int i = 0; i < 1000; i++) {
+        int vertex = rng.randint(10);
+        model.getLogLikelihoodIncreases(vertex, increases);
+        if (increases.size() != 5)
+            return 1;
+
+        for (int j = 0; j < 5; j++) {
+            PointMutation mutation(vertex, model.getType(vertex), j);
+            if (!ALMOST_EQUALS(increases[j],
+                        model.getLogLikelihoodIncrease(mutation), 1e-6))
+                return 2;
+        }
+
+        model.setType(vertex, rng.randint(5));
+    }
+
+    return 0;
+}
+
+int test_neighborTypeCache() {
+    Graph graph = *grg_game(100, 0.2);
+    UndirectedBlockmodel model =
+        Blockmodel::create<UndirectedBlockmodel>(&graph, 5);
+    UndirectedBlockmodel uncachedModel;
+    MersenneTwister rng;
+    Vector increases, uncachedIncreases;
+
+    model.randomize(rng);
+    model.setNeighborTypeCacheEnabled(true);
+    uncachedModel = model;
+    uncachedModel.setNeighborTypeCacheEnabled(false);
+
+    for (int i = 0; i < 2000; i++) {
+        int vertex = rng.randint(100);
+        int type = rng.randint(5);
+        model.setType(vertex, type);
+        uncachedModel.setType(vertex, type);
+
+        /* Check the histogram of a random vertex against its neighbors */
+        vertex = rng.randint(100);
+        Vector counts(5), cachedCounts(5);
+        const int* end = model.getNeighborsEnd(vertex);
+        for (const int* it = model.getNeighborsBegin(vertex); it != end; it++)
+            counts[model.getType(*it)]++;
+        for (int j = 0; j < model.getNumCachedNeighborTypes(vertex); j++) {
+            if (model.getCachedNeighborTypeCounts(vertex)[j] <= 0)
+                return 1;
+            cachedCounts[model.getCachedNeighborTypes(vertex)[j]] +=
+                model.getCachedNeighborTypeCounts(vertex)[j];
+        }
+        if (counts != cachedCounts)
+            return 2;
+
+        /* The increases must not depend on the cache */
+        model.getLogLikelihoodIncreases(vertex, increases);
+        uncachedModel.getLogLikelihoodIncreases(vertex, uncachedIncreases);
+        for (int j = 0; j < 5; j++) {
+            if (!ALMOST_EQUALS(increases[j], uncachedIncreases[j], 1e-6))
+                return 3;
+        }
+    }
+
+    return 0;
+}
+
+int test_sharedNeighborLists() {
+    Graph graph = *grg_game(100, 0.2);
+    UndirectedBlockmodel model =
+        Blockmodel::create<UndirectedBlockmodel>(&graph, 5);
+    UndirectedBlockmodel copy;
+    std::auto_ptr<Blockmodel> clone(model.clone());
+
+    /* Copies of the model must share the neighbor lists */
+    copy = model;
+    for (long i = 0; i < 100; i++) {
+        if (copy.getNeighborsBegin(i) != model.getNeighborsBegin(i) ||
+            clone->getNeighborsEnd(i) != model.getNeighborsEnd(i))
+            return 1;
+    }
+
+    /* Graphs without edges have empty neighbor lists */
+    Graph emptyGraph(10);
+    UndirectedBlockmodel emptyModel =
+        Blockmodel::create<UndirectedBlockmodel>(&emptyGraph, 2);
+    Vector increases;
+    emptyModel.setNeighborTypeCacheEnabled(true);
+    for (long i = 0; i < 10; i++) {
+        if (emptyModel.getNeighborsBegin(i) != emptyModel.getNeighborsEnd(i))
+            return 2;
+        if (emptyModel.getDegree(i) != 0)
+            return 3;
+        emptyModel.setType(i, i % 2);
+    }
+    emptyModel.getLogLikelihoodIncreases(0, increases);
+    if (increases.size() != 2)
+        return 4;
+
+    return 0;
+}
+
+int test_setNumTypes() {
+    Graph graph = *grg_game(50, 0.3);
+    UndirectedBlockmodel model =
+        Blockmodel::create<UndirectedBlockmodel>(&graph, 3);
+    MersenneTwister rng;
+
+    model.randomize(rng);
+    double logL = model.getLogLikelihood();
+    Matrix edgeCounts = model.getEdgeCounts();
+
+    /* Adding an empty group keeps the counts and the log-likelihood */
+    model.setNumTypes(4);
+    if (model.getTypeCount(3) != 0)
+        return 1;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            if (model.getEdgeCount(i, j) != edgeCounts(i, j))
+                return 2;
+    if (!ALMOST_EQUALS(model.getLogLikelihood(), logL, 1e-8))
+        return 3;
+
+    /* The new group can be used right away */
+    for (int i = 0; i < 10; i++)
+        model.setType(i, 3);
+    if (model.getTypeCount(3) != 10)
+        return 4;
+    if (!ALMOST_EQUALS(model.getLogLikelihood(),
+                model.recalculateLogLikelihood(), 1e-6))
+        return 5;
+
+    /* Emptying a group in the middle and removing it */
+    GroupMutation mutation(1, 3);
+    for (int i = 0; i < 50; i++) {
+        if (model.getType(i) == 1)
+            mutation.vertices.push_back(i);
+    }
+    long count = model.getTypeCount(1) + model.getTypeCount(3);
+    mutation.perform(model);
+    if (model.getNumTypes() != 3)
+        return 6;
+    if (model.getTypeCount(1) != count)
+        return 7;
+    if (!ALMOST_EQUALS(model.getLogLikelihood(),
+                model.recalculateLogLikelihood(), 1e-6))
+        return 8;
+
+    /* A group mutation to a new group splits a group */
+    GroupMutation split(0, 3);
+    split.vertices.push_back(0);
+    model.setType(0, 0);
+    split.perform(model);
+    if (model.getNumTypes() != 4 || model.getType(0) != 3)
+        return 9;
+    if (!ALMOST_EQUALS(model.getLogLikelihood(),
+                model.recalculateLogLikelihood(), 1e-6))
+        return 10;
+
+    return 0;
+}
+
+int test_mergeTypes() {
+    Graph graph = *grg_game(60, 0.3);
+    UndirectedBlockmodel model =
+        Blockmodel::create<UndirectedBlockmodel>(&graph, 6);
+    MersenneTwister rng;
+
+    /* The predicted increases must match the actual change after merging,
+     * and the merged group must get the smaller index */
+    model.randomize(rng);
+    while (model.getNumTypes() > 1) {
+        int numTypes = model.getNumTypes();
+        int type1 = rng.randint(numTypes), type2 = rng.randint(numTypes);
+        if (type1 == type2)
+            continue;
+
+        long mergedCount = model.getTypeCount(type1) + model.getTypeCount(type2);
+        double predictedLogL = model.getLogLikelihood() +
+            model.getMergeLogLikelihoodIncrease(type1, type2);
+        model.mergeTypes(type1, type2);
+
+        if (model.getNumTypes() != numTypes - 1)
+            return 1;
+        if (model.getTypeCount(std::min(type1, type2)) != mergedCount)
+            return 2;
+        if (!ALMOST_EQUALS(model.getLogLikelihood(), predictedLogL, 1e-6))
+            return 3;
+        if (!ALMOST_EQUALS(model.getLogLikelihood(),
+                    model.recalculateLogLikelihood(), 1e-6))
+            return 4;
+    }
+
+    return 0;
+}
+
+/* Checks the incrementally maintained degree sums against the edge counts */
+bool checkSumsOfDegrees(const Blockmodel& model) {
+    for (int i = 0; i < model.getNumTypes(); i++) {
+        long sum = 0;
+        for (int j = 0; j < model.getNumTypes(); j++)
+            sum += model.getEdgeCount(i, j);
+        if (model.getSumOfDegrees(i) != sum)
+            return false;
+    }
+    return true;
+}
+
+int test_getSumOfDegrees() {
+    Graph graph = *grg_game(60, 0.3);
+    UndirectedBlockmodel model =
+        Blockmodel::create<UndirectedBlockmodel>(&graph, 5);
+    MersenneTwister rng;
+
+    rng.init_genrand(42);
+    model.randomize(rng);
+    if (!checkSumsOfDegrees(model))
+        return 1;
+
+    for (int i = 0; i < 1000; i++) {
+        model.setType(rng.randint(60), rng.randint(model.getNumTypes()));
+        if (!checkSumsOfDegrees(model))
+            return 2;
+    }
+
+    /* Adding, merging and removing groups */
+    model.setNumTypes(6);
+    model.setType(0, 5);
+    if (!checkSumsOfDegrees(model))
+        return 3;
+    model.mergeTypes(1, 4);
+    if (!checkSumsOfDegrees(model))
+        return 4;
+    GroupMutation mutation(2, 0);
+    for (int i = 0; i < 60; i++) {
+        if (model.getType(i) == 2)
+            mutation.vertices.push_back(i);
+    }
+    mutation.perform(model);
+    if (model.getNumTypes() != 4 || !checkSumsOfDegrees(model))
+        return 5;
+
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     srand(time(0));
 
@@ -218,6 +504,13 @@ int main(int argc, char* argv[]) {
     CHECK(test_getLogLikelihood);
     CHECK(test_getTotalAndActualEdgesFromAffectedGroups);
     CHECK(test_getLogLikelihoodIncrease);
+    CHECK(test_getLogLikelihoodIncreases);
+    CHECK(test_incrementalLogLikelihood);
+    CHECK(test_neighborTypeCache);
+    CHECK(test_sharedNeighborLists);
+    CHECK(test_setNumTypes);
+    CHECK(test_mergeTypes);
+    CHECK(test_getSumOfDegrees);
 
     return 0;
 }
@@ -0,0 +1,86 @@
+/* vim:set ts=4 sw=4 sts=4 et: */
+
+#include <algorithm>
+#include <cmath>
+#include <block/math.hpp>
+
+#include "test_common.cpp"
+
+int test_small_values() {
+    if (xlogx(0) != 0.0 || xlogx(1) != 0.0)
+        return 1;
+
+    for (long x = 2; x < 1000; x++) {
+        if (!ALMOST_EQUALS(xlogx(x), x * std::log(static_cast<double>(x)), 1e-9))
+            return 2;
+    }
+
+    return 0;
+}
+
+int test_fallback() {
+    long x = XLogXTable::DEFAULT_SIZE + 12345;
+
+    if (!ALMOST_EQUALS(xlogx(x), x * std::log(static_cast<double>(x)), 1e-6))
+        return 1;
+
+    /* The last entry of the table and the first calculated value */
+    x = XLogXTable::DEFAULT_SIZE - 1;
+    if (!ALMOST_EQUALS(xlogx(x), x * std::log(static_cast<double>(x)), 1e-6))
+        return 2;
+    if (!ALMOST_EQUALS(xlogx(x + 1), (x + 1) * std::log(static_cast<double>(x + 1)), 1e-6))
+        return 3;
+
+    if (xlogx(-1) != 0.0)
+        return 4;
+
+    return 0;
+}
+
+int test_product() {
+    long pairs[] = { 0,5, 7,0, 1,1, 3,4, 1000,999, 100000,70000 };
+
+    for (int i = 0; i < 12; i += 2) {
+        double x = static_cast<double>(pairs[i]) * pairs[i+1];
+        double expected = (x > 0) ? x * std::log(x) : 0.0;
+        if (!ALMOST_EQUALS(xlogx_product(pairs[i], pairs[i+1]), expected,
+                    1e-12 * std::max(1.0, expected)))
+            return 1;
+    }
+
+    return 0;
+}
+
+int test_reserve() {
+    long x = XLogXTable::DEFAULT_SIZE + 12345;
+
+    /* Shrinking is a no-op */
+    XLogXTable::reserve(10);
+    if (XLogXTable::size() != XLogXTable::DEFAULT_SIZE)
+        return 1;
+
+    /* The new entries agree with the direct calculation */
+    XLogXTable::reserve(x + 1);
+    if (XLogXTable::size() != x + 1)
+        return 2;
+    if (!ALMOST_EQUALS(xlogx(x), x * std::log(static_cast<double>(x)), 1e-6))
+        return 3;
+    if (!ALMOST_EQUALS(xlogx(1000), 1000 * std::log(1000.0), 1e-9))
+        return 4;
+
+    /* The size is capped */
+    XLogXTable::reserve(XLogXTable::MAX_SIZE * 2);
+    if (XLogXTable::size() != XLogXTable::MAX_SIZE)
+        return 5;
+
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    CHECK(test_small_values);
+    CHECK(test_fallback);
+    CHECK(test_product);
+    CHECK(test_reserve);
+
+    return 0;
+}